@@ -0,0 +1,56 @@
+#include "allocCounter.hpp"
+#include <cerrno>
+#include <cstdlib>
+
+#include "utils.hpp"
+
+namespace {
+std::atomic<uint64_t> allocations{ 0 };
+std::atomic<uint64_t> allocatedBytes{ 0 };
+
+void countAllocation(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+}
+}
+
+AllocationCount getAllocationCount() { return { allocations.load(), allocatedBytes.load() }; }
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+
+void* malloc(size_t size) {
+	countAllocation(size);
+	return __libc_malloc(size);
+}
+void* calloc(size_t count, size_t size) {
+	countAllocation(count * size);
+	return __libc_calloc(count, size);
+}
+void* realloc(void* p, size_t size) {
+	countAllocation(size);
+	return __libc_realloc(p, size);
+}
+// The aligned operator new goes through aligned_alloc or posix_memalign
+void* aligned_alloc(size_t alignment, size_t size) {
+	countAllocation(size);
+	return __libc_memalign(alignment, size);
+}
+void* memalign(size_t alignment, size_t size) {
+	countAllocation(size);
+	return __libc_memalign(alignment, size);
+}
+int posix_memalign(void** p, size_t alignment, size_t size) {
+	if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+	countAllocation(size);
+	void* allocated = __libc_memalign(alignment, size);
+	if (!allocated) return ENOMEM;
+	*p = allocated;
+	return 0;
+}
+void free(void* p) { __libc_free(p); }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <atomic>
+#include "utils.hpp"
+
+// Counts the heap allocations of the benchmarks and of the allocation check the same way.
+// malloc and friends are replaced by counting wrappers around glibc's allocator, which also counts the
+// allocations of operator new, libpng and zlib. free is not counted.
+
+struct AllocationCount {
+	uint64_t allocations;
+	uint64_t bytes;
+};
+
+AllocationCount getAllocationCount();
@@ -0,0 +1,195 @@
+#include <chrono>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "allocCounter.hpp"
+#include "benchTree.hpp"
+#include "desktopEntries.hpp"
+#include "escape.hpp"
+#include "fileReader.hpp"
+#include "fuzzyMatch.hpp"
+#include "icons.hpp"
+#include "iniParse.hpp"
+#include "pngReader.hpp"
+#include "resample.hpp"
+#include "utils.hpp"
+
+// Per-stage microbenchmarks on a generated XDG tree, see benchTree.hpp.
+// Every stage runs for at least --time seconds and reports its throughput and the heap allocations per operation,
+// counted at malloc like the allocation check does.
+
+namespace {
+double minSeconds = 0.5;
+
+template<typename F>
+void bench(const char* name, F&& operation) {
+	// The first run warms up the page cache and the lazily built indexes
+	operation();
+	AllocationCount before = getAllocationCount();
+	auto start = std::chrono::steady_clock::now();
+	uint64_t ops = 0;
+	double elapsed;
+	do {
+		operation();
+		ops++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < minSeconds);
+	AllocationCount after = getAllocationCount();
+	printf("%-34s %14.1f ops/s %10.1f allocs/op %12.0f bytes/op\n", name, ops / elapsed,
+			double(after.allocations - before.allocations) / ops, double(after.bytes - before.bytes) / ops);
+}
+
+// Drops the files from the page cache, so that the next read has to go to the disk
+void evictFiles(const std::vector<FileRequest>& files) {
+	for (const auto& file : files) {
+		int fd = open(file.path.data(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) continue;
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+bool parseOption(std::string_view arg, std::string_view name, unsigned& value) {
+	if (arg.substr(0, name.size()) != name) return false;
+	auto number = arg.substr(name.size());
+	if (std::from_chars(number.data(), number.data() + number.size(), value).ec != std::errc())
+		throw std::runtime_error("Invalid value: " + std::string(arg));
+	return true;
+}
+}
+
+// The function try block unwinds the locals of main, so the tree is removed when a stage throws
+int main(int argc, char** argv) try {
+	BenchTreeOptions options;
+	fs::path generateOnly;
+	unsigned milliseconds = minSeconds * 1000;
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (parseOption(arg, "--entries=", options.entries) || parseOption(arg, "--icons=", options.icons)
+				|| parseOption(arg, "--dirs=", options.dataDirs) || parseOption(arg, "--time-ms=", milliseconds)) continue;
+		if (arg.substr(0, 11) == "--generate=") {
+			generateOnly = arg.substr(11);
+			continue;
+		}
+		std::cerr << "Unknown option: " << arg << '\n'
+			<< "Usage: " << argv[0] << " [--entries=N] [--icons=N] [--dirs=N] [--time-ms=N] [--generate=DIR]\n";
+		return 1;
+	}
+	minSeconds = milliseconds / 1000.0;
+
+	if (!generateOnly.empty()) {
+		generateBenchTree(generateOnly, options);
+		return 0;
+	}
+
+	TempDirectory root("desktop-dmenu-bench");
+	BenchTree tree = generateBenchTree(root.getPath(), options);
+	tree.setEnvironment();
+	printf("tree: %s, %u entries, %u icons\n", root.getPath().c_str(), options.entries, options.icons);
+
+	bench("iniFile parse", [&] {
+		iniFile file(tree.sampleEntry.native());
+	});
+	bench("DesktopEntries (entry cache)", [] {
+		DesktopEntries entries;
+	});
+	DesktopEntries entries;
+	bench("DesktopEntries rescan", [&] {
+		entries.rescan();
+	});
+	std::vector<std::string> entryFiles;
+	for (const auto& dataDir : tree.dataDirs)
+		for (const auto& file : fs::recursive_directory_iterator(dataDir / "applications"))
+			if (file.is_regular_file()) entryFiles.push_back(file.path());
+	std::vector<FileRequest> requests;
+	for (const auto& file : entryFiles) requests.push_back({ AT_FDCWD, file });
+	size_t readBytes = 0;
+	auto countBytes = [&readBytes](size_t, std::unique_ptr<char[]>, size_t size) { readBytes += size; };
+	// The cold runs evict the files before every read, with the same cost for both backends.
+	// On a tmpfs nothing is evicted and the cold runs measure the same as the warm ones.
+	for (auto backend : { FileReader::Backend::READ, FileReader::Backend::IO_URING }) {
+		auto reader = FileReader::create(backend);
+		const char* name = backend == FileReader::Backend::READ ? "read" : "io_uring";
+		if (!reader) {
+			printf("FileReader %s: not available\n", name);
+			continue;
+		}
+		bench(("FileReader " + std::string(name) + " (warm)").c_str(), [&] {
+			reader->readFiles(requests, countBytes);
+		});
+		bench(("FileReader " + std::string(name) + " (cold)").c_str(), [&] {
+			evictFiles(requests);
+			reader->readFiles(requests, countBytes);
+		});
+	}
+
+	bench("FuzzyMatcher filter", [&] {
+		FuzzyMatcher matcher(entries);
+		matcher.filter("bench");
+	});
+	FuzzyMatcher matcher(entries);
+	bench("FuzzyMatcher filter (extended query)", [&] {
+		matcher.filter("be");
+		matcher.filter("ben");
+		matcher.filter("bench 1");
+	});
+
+	auto iconPaths = tree.getIconPaths();
+	bench("IconTheme index", [&] {
+		IconTheme theme("hicolor");
+		theme.queryIcons("bench-icon-0", iconPaths);
+	});
+
+	// prepare probes or indexes depending on the number of names, the stats report which one ran
+	std::vector<std::string_view> someNames(begin(tree.iconNames), begin(tree.iconNames) + std::min<size_t>(100, tree.iconNames.size()));
+	bench("Icons prepare 100 names", [&] {
+		Icons fresh;
+		fresh.prepare(someNames);
+	});
+
+	Icons icons;
+	size_t next = 0;
+	bench("queryIconClosestSize (hit)", [&] {
+		icons.queryIconClosestSize(tree.iconNames[next++ % tree.iconNames.size()], 16);
+	});
+	bench("queryIconClosestSize (miss)", [&] {
+		icons.queryIconClosestSize("bench-missing", 16);
+	});
+
+	bench("PngReader decode", [&] {
+		PngReader png(tree.sampleIcon);
+		png.getPixels();
+	});
+	ResampleScratch scratch;
+	std::string rendered;
+	bench("PngReader decode + scale to 16", [&] {
+		rendered.clear();
+		PngReader png(tree.sampleIcon);
+		png.renderScaled(16, 16, scratch, rendered);
+	});
+
+	std::vector<uint8_t> pixels(64 * 64 * 4);
+	std::mt19937 random(1);
+	for (auto& b : pixels) b = random();
+	// The random alpha makes every row go through premultiplying
+	bench("resample 64 -> 16 (integer ratio)", [&] {
+		resample(pixels.data(), 64, 64, 16, 16);
+	});
+	bench("resample 64 -> 24 (area)", [&] {
+		resample(pixels.data(), 64, 64, 24, 24);
+	});
+	std::string escaped;
+	bench("appendEscaped 16KiB", [&] {
+		escaped.clear();
+		appendEscaped(escaped, pixels.data(), pixels.size());
+	});
+	return 0;
+} catch (const std::exception& e) {
+	std::cerr << "bench failed: " << e.what() << '\n';
+	return 1;
+}
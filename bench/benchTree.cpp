@@ -0,0 +1,148 @@
+#include "benchTree.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <png.h>
+
+#include "utils.hpp"
+
+namespace {
+// Deterministic pseudo random numbers, the tree must not depend on the platform's generators
+struct Lcg {
+	uint32_t state;
+	uint32_t next() {
+		state = state * 1664525u + 1013904223u;
+		return state >> 8;
+	}
+};
+
+void writePng(const fs::path& path, uint32_t size, uint32_t seed) {
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) throw std::runtime_error("cannot create " + path.native());
+	png_struct* png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+	png_info* info = png_create_info_struct(png);
+	png_init_io(png, fp);
+	png_set_IHDR(png, info, size, size, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+
+	// A gradient with noise, close enough to real icons for the decoder and the resampler
+	Lcg random{ seed };
+	std::vector<uint8_t> row(size * 4);
+	for (uint32_t y = 0; y < size; y++) {
+		for (uint32_t x = 0; x < size; x++) {
+			uint32_t noise = random.next();
+			row[x * 4] = x * 255 / size ^ (noise & 0x0f);
+			row[x * 4 + 1] = y * 255 / size ^ (noise >> 4 & 0x0f);
+			row[x * 4 + 2] = seed * 37 + (noise >> 8 & 0x1f);
+			row[x * 4 + 3] = x < size / 8 || y < size / 8 ? 0 : 255;
+		}
+		png_write_row(png, row.data());
+	}
+	png_write_end(png, nullptr);
+	png_destroy_write_struct(&png, &info);
+	fclose(fp);
+}
+
+void writeIndexTheme(const fs::path& themeDir, const std::vector<uint32_t>& sizes) {
+	std::ofstream index(themeDir / "index.theme");
+	index << "[Icon Theme]\nName=Hicolor\nDirectories=";
+	for (size_t i = 0; i < sizes.size(); i++)
+		index << (i ? "," : "") << sizes[i] << 'x' << sizes[i] << "/apps";
+	index << ",scalable/apps\n";
+	for (auto size : sizes)
+		index << "\n[" << size << 'x' << size << "/apps]\nSize=" << size << "\nContext=Applications\nType=Threshold\n";
+	index << "\n[scalable/apps]\nSize=128\nContext=Applications\nType=Scalable\n";
+}
+
+void writeEntry(const fs::path& path, unsigned i, std::string_view icon) {
+	std::ofstream entry(path);
+	entry << "[Desktop Entry]\n"
+		<< "Type=Application\n"
+		<< "Name=Bench Application " << i << '\n'
+		<< "Name[de]=Testanwendung " << i << '\n'
+		<< "Name[fr]=Application de test " << i << '\n'
+		<< "GenericName=Benchmark Tool\n"
+		<< "Comment=Generated entry number " << i << " for the benchmarks\n"
+		<< "Exec=bench-app-" << i << " --new-window %U\n"
+		<< "Icon=" << icon << '\n'
+		<< "Terminal=" << (i % 7 == 0 ? "true" : "false") << '\n'
+		<< "Categories=Utility;Development;\n"
+		<< "Keywords=bench;test;app" << i << ";\n"
+		<< "StartupNotify=true\n"
+		<< "Actions=new-window;\n"
+		<< "\n[Desktop Action new-window]\n"
+		<< "Name=New Window\n"
+		<< "Exec=bench-app-" << i << " --new-window\n";
+}
+}
+
+// ==========================================
+// BenchTree
+// ==========================================
+
+void BenchTree::setEnvironment() const {
+	std::string dataDirsVar;
+	// DesktopEntries and Icons expect XDG_DATA_DIRS to end with a separator
+	for (const auto& dir : dataDirs) dataDirsVar += dir.native() + ':';
+	setenv("XDG_DATA_DIRS", dataDirsVar.c_str(), 1);
+	setenv("HOME", (root / "home").c_str(), 1);
+	setenv("XDG_CACHE_HOME", (root / "cache").c_str(), 1);
+}
+
+std::vector<fs::path> BenchTree::getIconPaths() const {
+	std::vector<fs::path> paths = { root / "home/.icons" };
+	for (const auto& dir : dataDirs) paths.push_back(dir / "icons");
+	return paths;
+}
+
+BenchTree generateBenchTree(const fs::path& root, const BenchTreeOptions& options) {
+	BenchTree tree{ root, {}, {}, {}, {} };
+	fs::create_directories(root / "home");
+	fs::create_directories(root / "cache");
+	for (unsigned d = 0; d < std::max(options.dataDirs, 1u); d++) {
+		tree.dataDirs.push_back(root / ("data" + std::to_string(d)));
+		fs::create_directories(tree.dataDirs.back() / "applications");
+	}
+
+	fs::path themeDir = tree.dataDirs[0] / "icons/hicolor";
+	fs::create_directories(themeDir / "scalable/apps");
+	writeIndexTheme(themeDir, options.sizes);
+	for (auto size : options.sizes) fs::create_directories(themeDir / (std::to_string(size) + 'x' + std::to_string(size)) / "apps");
+	for (unsigned i = 0; i < options.icons; i++) {
+		tree.iconNames.push_back("bench-icon-" + std::to_string(i));
+		for (auto size : options.sizes) {
+			fs::path path = themeDir / (std::to_string(size) + 'x' + std::to_string(size)) / "apps" / (tree.iconNames.back() + ".png");
+			writePng(path, size, i);
+		}
+	}
+	if (!options.sizes.empty() && !tree.iconNames.empty()) {
+		uint32_t largest = *std::max_element(begin(options.sizes), end(options.sizes));
+		tree.sampleIcon = themeDir / (std::to_string(largest) + 'x' + std::to_string(largest)) / "apps" / (tree.iconNames[0] + ".png");
+	}
+
+	Lcg random{ 42 };
+	for (unsigned i = 0; i < options.entries; i++) {
+		fs::path path = tree.dataDirs[i % tree.dataDirs.size()] / "applications" / ("bench-app-" + std::to_string(i) + ".desktop");
+		bool missing = tree.iconNames.empty() || random.next() % 100 < options.missingIcons;
+		writeEntry(path, i, missing ? "bench-missing-" + std::to_string(i) : tree.iconNames[i % tree.iconNames.size()]);
+		if (i == 0) tree.sampleEntry = path;
+	}
+	return tree;
+}
+
+// ==========================================
+// TempDirectory
+// ==========================================
+
+TempDirectory::TempDirectory(std::string_view prefix) {
+	std::string pathTemplate = "/tmp/" + std::string(prefix) + ".XXXXXX";
+	if (!mkdtemp(pathTemplate.data())) throw std::runtime_error("cannot create " + pathTemplate);
+	path = pathTemplate;
+}
+TempDirectory::~TempDirectory() {
+	std::error_code ec;
+	fs::remove_all(path, ec);
+}
+
+const fs::path& TempDirectory::getPath() const { return path; }
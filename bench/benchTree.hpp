@@ -0,0 +1,42 @@
+#pragma once
+
+#include "utils.hpp"
+
+// Generates a reproducible fake XDG tree for the benchmarks. The same options always give the same files:
+// root/data<D>/applications/bench-app-<N>.desktop   the entries, spread over the data directories
+// root/data0/icons/hicolor/<S>x<S>/apps/<icon>.png  the icons, one per size directory
+// root/home, root/cache                             HOME and XDG_CACHE_HOME
+struct BenchTreeOptions {
+	unsigned entries = 1000;
+	unsigned dataDirs = 3;
+	unsigned icons = 500;
+	std::vector<uint32_t> sizes = { 16, 32, 48, 64, 128 };
+	// Percentage of the entries whose icon is in no theme
+	unsigned missingIcons = 10;
+};
+
+struct BenchTree {
+	fs::path root;
+	std::vector<fs::path> dataDirs;
+	std::vector<std::string> iconNames;
+	fs::path sampleEntry;
+	// The sample icon at the largest size
+	fs::path sampleIcon;
+
+	// Points XDG_DATA_DIRS, HOME and XDG_CACHE_HOME at the tree
+	void setEnvironment() const;
+	std::vector<fs::path> getIconPaths() const;
+};
+
+BenchTree generateBenchTree(const fs::path& root, const BenchTreeOptions& options);
+
+// A new directory in /tmp, removed with its content when going out of scope
+class TempDirectory {
+	fs::path path;
+public:
+	TempDirectory(std::string_view prefix);
+	TempDirectory(const TempDirectory&) = delete;
+	~TempDirectory();
+
+	const fs::path& getPath() const;
+};
@@ -0,0 +1,94 @@
+#include "cacheFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+#include "utils.hpp"
+
+fs::path getCacheDir() {
+	std::string cacheHome = getEnviroment("XDG_CACHE_HOME"sv);
+	fs::path base = cacheHome.empty() ? fs::path(getEnviroment("HOME"sv)) / ".cache" : fs::path(cacheHome);
+	return base / "desktop-dmenu";
+}
+int64_t getMtime(const fs::path& path) {
+	struct stat st;
+	Stats::add(Stats::FILES_STATED);
+	if (stat(path.c_str(), &st) != 0) return -1;
+	return st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+}
+bool writeFileAtomic(const fs::path& path, const std::vector<std::string_view>& parts) {
+	std::error_code ec;
+	fs::create_directories(path.parent_path(), ec);
+	fs::path tmpPath = path;
+	tmpPath += ".tmp." + std::to_string(getpid());
+
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) return false;
+	bool ok = true;
+	for (auto part : parts) {
+		while (!part.empty()) {
+			ssize_t written = write(fd, part.data(), part.size());
+			if (written < 0) { ok = false; break; }
+			part.remove_prefix(written);
+		}
+		if (!ok) break;
+	}
+	ok &= close(fd) == 0;
+	if (ok) ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+	if (!ok) unlink(tmpPath.c_str());
+	return ok;
+}
+
+// ==========================================
+// MappedFile
+// ==========================================
+
+MappedFile::MappedFile(const fs::path& path) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return;
+	Stats::add(Stats::FILES_OPENED);
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			data = static_cast<const char*>(mapping);
+			size = st.st_size;
+			mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+		}
+	}
+	close(fd);
+}
+MappedFile::MappedFile(MappedFile&& other) : data(other.data), size(other.size), mtime(other.mtime) {
+	other.data = nullptr;
+	other.size = 0;
+}
+MappedFile& MappedFile::operator=(MappedFile&& other) {
+	std::swap(data, other.data);
+	std::swap(size, other.size);
+	std::swap(mtime, other.mtime);
+	return *this;
+}
+MappedFile::~MappedFile() {
+	if (data) munmap(const_cast<char*>(data), size);
+}
+
+bool MappedFile::isOpen() const { return data != nullptr; }
+const char* MappedFile::getData() const { return data; }
+size_t MappedFile::getSize() const { return size; }
+int64_t MappedFile::getMtime() const { return mtime; }
+std::string_view MappedFile::view() const { return { data, size }; }
+
+// ==========================================
+// StringTable
+// ==========================================
+
+StrRef StringTable::add(std::string_view str) {
+	StrRef ref = { (uint32_t)data.size(), (uint32_t)str.size() };
+	data += str;
+	return ref;
+}
+std::string_view StringTable::view() const { return data; }
+size_t StringTable::size() const { return data.size(); }
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "utils.hpp"
+
+// Helpers shared by the on-disk caches, all of them live in $XDG_CACHE_HOME/desktop-dmenu
+
+fs::path getCacheDir();
+// Returns the mtime of a file in nanoseconds, or -1 if the file doesn't exist
+int64_t getMtime(const fs::path& path);
+// Writes the parts into a temporary file and renames it over path, so readers never see a partial file
+bool writeFileAtomic(const fs::path& path, const std::vector<std::string_view>& parts);
+
+// A directory whose mtime is part of a cache key
+struct CachedDirectory {
+	fs::path path;
+	int64_t mtime;
+};
+
+// Read-only mapping of a whole file, a missing file results in an empty mapping
+class MappedFile {
+	const char* data = nullptr;
+	size_t size = 0;
+	int64_t mtime = -1;
+public:
+	MappedFile() = default;
+	MappedFile(const fs::path& path);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other);
+	MappedFile& operator=(MappedFile&& other);
+	~MappedFile();
+
+	bool isOpen() const;
+	const char* getData() const;
+	size_t getSize() const;
+	int64_t getMtime() const;
+	std::string_view view() const;
+
+	template<typename T> const T* at(size_t offset, size_t count = 1) const {
+		if (offset > size || count > (size - offset) / sizeof(T)) return nullptr;
+		return reinterpret_cast<const T*>(data + offset);
+	}
+};
+
+// Reference to a string stored in the string table of a cache file
+struct StrRef {
+	uint32_t offset, length;
+};
+
+class StringTable {
+	std::string data;
+public:
+	StrRef add(std::string_view str);
+	std::string_view view() const;
+	size_t size() const;
+};
+
+inline std::string_view resolve(std::string_view strings, StrRef ref) {
+	if (ref.offset > strings.size() || ref.length > strings.size() - ref.offset) return {};
+	return strings.substr(ref.offset, ref.length);
+}
+template<typename T> std::string_view asBytes(const T& value) {
+	return { reinterpret_cast<const char*>(&value), sizeof(T) };
+}
+template<typename T> std::string_view asBytes(const std::vector<T>& values) {
+	return { reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T) };
+}
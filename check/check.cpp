@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "allocCounter.hpp"
+#include "benchTree.hpp"
+#include "desktopEntries.hpp"
+#include "entryList.hpp"
+#include "fuzzyMatch.hpp"
+#include "iconBlobCache.hpp"
+#include "iconPipeline.hpp"
+#include "icons.hpp"
+#include "iniParse.hpp"
+#include "pngCheck.hpp"
+#include "utils.hpp"
+
+// Allocation accounting for the phases of a run on a generated XDG tree, see bench/benchTree.hpp.
+// The allocations are counted at malloc, see bench/allocCounter.hpp. Each phase reports its allocations, the bytes
+// requested and how far the peak RSS grew over the RSS before the phase, the peak is reset through /proc/self/clear_refs.
+// The growth is budgeted rather than the peak, which is mostly the libraries and differs between systems.
+// The results are compared to the budgets file, a phase over its budget fails the check.
+// Everything runs on one thread so that the counts are the same on every machine.
+// Afterwards the fast PNG decoder is compared with libpng, see check/pngCheck.hpp.
+
+namespace {
+struct Usage {
+	uint64_t allocations;
+	uint64_t bytes;
+	uint64_t rssGrowthKib;
+};
+// The budgets file has one phase per line: name allocations bytes rss_growth_kib, '#' starts a comment
+using Budgets = std::vector<std::pair<std::string, Usage>>;
+
+// Reads a field of /proc/self/status in KiB, like VmRSS or VmHWM, the peak RSS
+uint64_t readStatus(std::string_view field) {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.compare(0, field.size(), field) == 0 && line[field.size()] == ':')
+			return std::strtoull(line.c_str() + field.size() + 1, nullptr, 10);
+	return 0;
+}
+
+// Writing 5 to clear_refs resets the peak RSS to the current RSS
+void resetPeakRss() {
+	int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+	if (fd < 0) return;
+	if (write(fd, "5", 1) < 0) {}
+	close(fd);
+}
+
+template<typename F>
+Usage measure(F&& phase) {
+	resetPeakRss();
+	uint64_t startRss = readStatus("VmRSS");
+	AllocationCount before = getAllocationCount();
+	phase();
+	AllocationCount after = getAllocationCount();
+	Usage usage = { after.allocations - before.allocations, after.bytes - before.bytes, 0 };
+	uint64_t peakRss = readStatus("VmHWM");
+	usage.rssGrowthKib = peakRss > startRss ? peakRss - startRss : 0;
+	return usage;
+}
+
+Budgets readBudgets(const fs::path& path) {
+	Budgets budgets;
+	std::ifstream file(path);
+	std::string line;
+	while (std::getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		std::string name;
+		Usage usage;
+		if (fields >> name >> usage.allocations >> usage.bytes >> usage.rssGrowthKib) budgets.emplace_back(name, usage);
+	}
+	return budgets;
+}
+
+// New budgets leave a quarter of headroom over the measured usage. The RSS growth also gets RSS_SLACK_KIB,
+// since small phases grow by a few pages that depend on the state of the allocator.
+constexpr uint64_t RSS_SLACK_KIB = 256;
+void writeBudgets(const fs::path& path, const Budgets& measured) {
+	std::ofstream file(path);
+	file << "# phase            allocations        bytes rss_growth_kib\n"
+		<< "# Generated by make check CHECKARGS=--write-budgets, the measurements plus 25%\n";
+	auto headroom = [](uint64_t value) { return value + value / 4 + 1; };
+	for (const auto& [ name, usage ] : measured) {
+		char line[128];
+		snprintf(line, sizeof line, "%-16s %13lu %12lu %14lu\n", name.c_str(), (unsigned long)headroom(usage.allocations),
+				(unsigned long)headroom(usage.bytes), (unsigned long)(headroom(usage.rssGrowthKib) + RSS_SLACK_KIB));
+		file << line;
+	}
+}
+}
+
+// The function try block unwinds the locals of main, so the tree is removed when a phase throws
+int main(int argc, char** argv) try {
+	fs::path budgetsPath = "check/budgets.txt";
+	bool update = false;
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg.substr(0, 10) == "--budgets=") {
+			budgetsPath = arg.substr(10);
+		} else if (arg == "--write-budgets") {
+			update = true;
+		} else {
+			std::cerr << "Unknown option: " << arg << '\n'
+				<< "Usage: " << argv[0] << " [--budgets=FILE] [--write-budgets]\n";
+			return 1;
+		}
+	}
+
+	TempDirectory root("desktop-dmenu-check");
+	BenchTreeOptions options;
+	options.entries = 300;
+	options.icons = 100;
+	BenchTree tree = generateBenchTree(root.getPath(), options);
+	tree.setEnvironment();
+
+	std::vector<std::string> entryFiles;
+	for (const auto& dataDir : tree.dataDirs)
+		for (const auto& file : fs::recursive_directory_iterator(dataDir / "applications"))
+			if (file.is_regular_file()) entryFiles.push_back(file.path());
+
+	Budgets measured;
+	measured.emplace_back("ini-parse", measure([&] {
+		for (const auto& file : entryFiles) iniFile parsed(file);
+	}));
+	measured.emplace_back("entries-scan", measure([] {
+		DesktopEntries entries(1);
+	}));
+	measured.emplace_back("entries-cache", measure([] {
+		DesktopEntries entries(1);
+	}));
+
+	DesktopEntries entries(1);
+	std::vector<DesktopEntryView> views(begin(entries), end(entries));
+	std::vector<std::string_view> iconNames;
+	for (auto entry : entries) iconNames.push_back(entry.getIconId());
+	Icons icons;
+	measured.emplace_back("icons-prepare", measure([&] {
+		icons.prepare(iconNames);
+	}));
+	measured.emplace_back("icons-render", measure([&] {
+		IconBlobCache iconCache(tree.root / "render-cache");
+		IconPipeline pipeline(views, icons, iconCache, 16, 1);
+		for (size_t i = 0; i < views.size(); i++) pipeline.get(i);
+		iconCache.save();
+	}));
+	measured.emplace_back("fuzzy-filter", measure([&] {
+		FuzzyMatcher matcher(entries);
+		matcher.filter("be");
+		matcher.filter("bench");
+	}));
+	int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	measured.emplace_back("entry-list", measure([&] {
+		writeEntryList(devNull, entries, ListFormat::JSON);
+	}));
+	close(devNull);
+
+	if (update) {
+		writeBudgets(budgetsPath, measured);
+		printf("wrote %s\n", budgetsPath.c_str());
+		return 0;
+	}
+
+	Budgets budgets = readBudgets(budgetsPath);
+	bool failed = false;
+	printf("%-16s %13s %12s %14s\n", "phase", "allocations", "bytes", "rss_growth_kib");
+	for (const auto& [ name, usage ] : measured) {
+		printf("%-16s %13lu %12lu %14lu", name.c_str(), (unsigned long)usage.allocations, (unsigned long)usage.bytes,
+				(unsigned long)usage.rssGrowthKib);
+		auto budget = std::find_if(begin(budgets), end(budgets), [&name = name](const auto& b) { return b.first == name; });
+		if (budget == end(budgets)) {
+			printf("  no budget\n");
+			continue;
+		}
+		std::string over;
+		if (usage.allocations > budget->second.allocations) over += " allocations";
+		if (usage.bytes > budget->second.bytes) over += " bytes";
+		if (usage.rssGrowthKib > budget->second.rssGrowthKib) over += " rss_growth_kib";
+		if (over.empty()) printf("  ok\n");
+		else printf("  OVER BUDGET:%s\n", over.c_str());
+		failed |= !over.empty();
+	}
+	failed |= !checkPngDecoder(root.getPath() / "png");
+	return failed ? 1 : 0;
+} catch (const std::exception& e) {
+	std::cerr << "check failed: " << e.what() << '\n';
+	return 1;
+}
@@ -0,0 +1,183 @@
+#include "pngCheck.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <png.h>
+#include <zlib.h>
+
+#include "pngDecode.hpp"
+#include "pngReader.hpp"
+#include "utils.hpp"
+
+namespace {
+enum ColorType : uint8_t { GRAY = 0, RGB = 2, GRAY_ALPHA = 4, RGBA = 6 };
+enum Filter : uint8_t { NONE, SUB, UP, AVERAGE, PAETH, MIXED };
+
+struct TestImage {
+	uint32_t width, height;
+	uint8_t depth;
+	ColorType colorType;
+	// The filter of every row, MIXED cycles through the five
+	Filter filter;
+	// Splits the compressed data over small IDAT chunks
+	bool splitIdat;
+};
+
+void append32(std::string& out, uint32_t value) {
+	for (int shift = 24; shift >= 0; shift -= 8) out += (char)(value >> shift);
+}
+
+void appendChunk(std::string& out, const char* type, std::string_view data) {
+	append32(out, data.size());
+	size_t start = out.size();
+	out.append(type, 4);
+	out += data;
+	append32(out, crc32(0, (const Bytef*)out.data() + start, data.size() + 4));
+}
+
+// Compresses the filtered rows and writes them as a PNG
+void writePng(const fs::path& path, const TestImage& image, std::string_view filtered) {
+	uLongf compressedSize = compressBound(filtered.size());
+	std::string compressed(compressedSize, '\0');
+	if (compress2((Bytef*)compressed.data(), &compressedSize, (const Bytef*)filtered.data(), filtered.size(), 6) != Z_OK)
+		throw std::runtime_error("compress2 failed");
+	compressed.resize(compressedSize);
+
+	std::string file("\x89PNG\r\n\x1a\n", 8);
+	std::string ihdr;
+	append32(ihdr, image.width);
+	append32(ihdr, image.height);
+	ihdr += (char)image.depth;
+	ihdr += (char)image.colorType;
+	// compression, filter and interlace methods
+	ihdr.append(3, '\0');
+	appendChunk(file, "IHDR", ihdr);
+	const size_t chunkSize = image.splitIdat ? 97 : compressed.size();
+	for (size_t pos = 0; pos < compressed.size(); pos += chunkSize)
+		appendChunk(file, "IDAT", std::string_view(compressed).substr(pos, chunkSize));
+	appendChunk(file, "IEND", {});
+	std::ofstream out(path, std::ios::binary);
+	out << file;
+}
+
+int paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	return pb <= pc ? b : c;
+}
+
+// Writes the image with random samples and returns the RGBA pixels PngReader should decode it to,
+// 16-bit samples are stripped to their high byte
+std::vector<uint8_t> writeImage(const fs::path& path, const TestImage& image, std::mt19937& random) {
+	const uint32_t channels = image.colorType == GRAY ? 1 : image.colorType == GRAY_ALPHA ? 2 : image.colorType == RGB ? 3 : 4;
+	const uint32_t sampleBytes = image.depth / 8;
+	const uint32_t bpp = channels * sampleBytes;
+	const size_t stride = (size_t)image.width * bpp;
+
+	std::vector<uint8_t> raw(stride * image.height);
+	for (auto& byte : raw) byte = random();
+
+	std::vector<uint8_t> expected;
+	expected.reserve((size_t)image.width * image.height * 4);
+	for (size_t i = 0; i < raw.size(); i += bpp) {
+		auto sample = [&](uint32_t channel) { return raw[i + channel * sampleBytes]; };
+		if (channels <= 2) expected.insert(end(expected), { sample(0), sample(0), sample(0) });
+		else expected.insert(end(expected), { sample(0), sample(1), sample(2) });
+		expected.push_back(channels == 2 ? sample(1) : channels == 4 ? sample(3) : 0xff);
+	}
+
+	std::string filtered;
+	filtered.reserve((stride + 1) * image.height);
+	for (uint32_t y = 0; y < image.height; y++) {
+		const Filter filter = image.filter == MIXED ? (Filter)(y % MIXED) : image.filter;
+		const uint8_t* row = raw.data() + stride * y;
+		const uint8_t* prior = y > 0 ? row - stride : nullptr;
+		filtered += (char)filter;
+		for (size_t x = 0; x < stride; x++) {
+			int a = x >= bpp ? row[x - bpp] : 0;
+			int b = prior ? prior[x] : 0;
+			int c = prior && x >= bpp ? prior[x - bpp] : 0;
+			int predicted = 0;
+			switch (filter) {
+			case SUB: predicted = a; break;
+			case UP: predicted = b; break;
+			case AVERAGE: predicted = (a + b) / 2; break;
+			case PAETH: predicted = paeth(a, b, c); break;
+			default: break;
+			}
+			filtered += (char)(row[x] - predicted);
+		}
+	}
+	writePng(path, image, filtered);
+	return expected;
+}
+
+// Decodes the file with the simplified API of libpng, which leaves 8-bit samples without a gAMA chunk as they are
+std::vector<uint8_t> decodeWithLibpng(const fs::path& path) {
+	png_image image = {};
+	image.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_file(&image, path.c_str())) return {};
+	image.format = PNG_FORMAT_RGBA;
+	std::vector<uint8_t> pixels(PNG_IMAGE_SIZE(image));
+	if (!png_image_finish_read(&image, nullptr, pixels.data(), 0, nullptr)) return {};
+	return pixels;
+}
+}
+
+bool checkPngDecoder(const fs::path& dir) {
+	fs::create_directories(dir);
+	std::mt19937 random(1);
+
+	std::vector<TestImage> images;
+	for (ColorType colorType : { RGB, RGBA })
+		for (Filter filter : { NONE, SUB, UP, AVERAGE, PAETH, MIXED })
+			images.push_back({ 33, 9, 8, colorType, filter, filter == MIXED });
+	// Widths that leave a remainder after the vector loops, and a single row
+	for (uint32_t width : { 1, 2, 5, 17 }) images.push_back({ width, 7, 8, RGBA, MIXED, false });
+	images.push_back({ 40, 1, 8, RGB, MIXED, false });
+	// Left to libpng
+	for (ColorType colorType : { GRAY, GRAY_ALPHA, RGB, RGBA }) images.push_back({ 13, 6, 16, colorType, MIXED, false });
+	for (ColorType colorType : { GRAY, GRAY_ALPHA }) images.push_back({ 13, 6, 8, colorType, MIXED, false });
+
+	int failures = 0;
+	auto fail = [&](const fs::path& path, const char* what) {
+		fprintf(stderr, "png-decode: %s: %s\n", path.c_str(), what);
+		failures++;
+	};
+	for (size_t i = 0; i < images.size(); i++) {
+		const auto& image = images[i];
+		fs::path path = dir / ("image" + std::to_string(i) + ".png");
+		std::vector<uint8_t> expected = writeImage(path, image, random);
+		const bool simple = image.depth == 8 && (image.colorType == RGB || image.colorType == RGBA);
+
+		std::vector<uint8_t> pixels;
+		uint32_t width = 0, height = 0;
+		const bool decoded = decodeSimplePng(path, pixels, width, height);
+		if (decoded != simple) {
+			fail(path, simple ? "not decoded by the fast path" : "decoded by the fast path");
+		} else if (simple) {
+			std::vector<uint8_t> reference = decodeWithLibpng(path);
+			if (reference != expected) fail(path, "libpng differs from the written image");
+			else if (width != image.width || height != image.height || pixels != reference) fail(path, "the fast path differs from libpng");
+		}
+		// Whichever decoder PngReader picks
+		if (PngReader(path).getPixels() != expected) fail(path, "PngReader differs from the written image");
+	}
+
+	// The header of an image over MAX_ICON_PIXELS with a single row of data
+	TestImage huge = { 8192, 8192, 8, RGBA, NONE, false };
+	fs::path hugePath = dir / "huge.png";
+	writePng(hugePath, huge, std::string(huge.width * 4 + 1, '\0'));
+	std::vector<uint8_t> pixels;
+	uint32_t width = 0, height = 0;
+	if (decodeSimplePng(hugePath, pixels, width, height) || pixels.capacity() != 0) fail(hugePath, "allocated by the fast path");
+	try {
+		PngReader(hugePath).getPixels();
+		fail(hugePath, "decoded by PngReader");
+	} catch (const std::runtime_error&) {}
+
+	printf("%-16s %13zu images  %s\n", "png-decode", images.size() + 1, failures ? "FAILED" : "ok");
+	return failures == 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "utils.hpp"
+
+// Checks the fast PNG decoder against libpng on images generated in dir: 8-bit RGB and RGBA with every filter type
+// must decode to the same bytes, the other bit depths and color types must be left to libpng, and an image over
+// MAX_ICON_PIXELS must be rejected before it's allocated. Prints the result, returns false if any image differs.
+bool checkPngDecoder(const fs::path& dir);
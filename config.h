@@ -11,12 +11,26 @@ using strvec = std::initializer_list<sv>;
 // args to pass into dmenu -I and -n are required
 constexpr static strvec DMENU_ARGS = { "-I"sv, "-n"sv, "-i"sv, "-c"sv, "-l"sv, "20"sv };
 
-// the shell that will run the exec commands
-constexpr static sv SHELL = "sh";
-// the args to pass to the shell, the desktop entry's exec command will be appended
-constexpr static strvec SHELL_ARGS = { "-c"sv };
-
 // the terminal that will open terminal programs
 constexpr static sv TERMINAL = "kitty";
-// the args to pass to the terminal, the desktop entry's exec command will be appended
-constexpr static strvec TERMINAL_ARGS = { "sh"sv, "-c"sv };
+// the args to pass to the terminal, the program and its args will be appended (xterm needs "-e"sv)
+constexpr static strvec TERMINAL_ARGS = {};
+
+// the number of threads used to parse the desktop entries, 0 uses the number of cores and 1 disables threading
+constexpr static unsigned WORKER_THREADS = 0;
+
+// the number of matches printed by --query, 0 prints every match
+constexpr static size_t QUERY_RESULTS = 10;
+
+// read the desktop entries and the index.theme files in batches through io_uring, if the kernel supports it.
+// It's faster when the files are not in the page cache but slower when they are, which is the common case
+constexpr static bool USE_IO_URING = false;
+
+// the nice level of --warm, which fills the caches in the background at idle I/O priority
+constexpr static int WARM_NICE = 19;
+
+// the largest icon in pixels that is decoded, larger files are skipped instead of allocating the whole image
+constexpr static uint64_t MAX_ICON_PIXELS = 4096 * 4096;
+
+// the icon theme to take the icons from, the themes it inherits from and hicolor are used as fallbacks
+constexpr static sv ICON_THEME = "hicolor";
@@ -0,0 +1,298 @@
+#include "daemon.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "menu.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+namespace {
+// MSG_NOSIGNAL: a peer that goes away must not kill us with SIGPIPE
+bool writeAll(int fd, std::string_view data) {
+	while (!data.empty()) {
+		ssize_t written = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return false;
+		data.remove_prefix(written);
+	}
+	return true;
+}
+bool readAll(int fd, char* data, size_t size) {
+	while (size > 0) {
+		ssize_t readCount = read(fd, data, size);
+		if (readCount < 0 && errno == EINTR) continue;
+		if (readCount <= 0) return false;
+		data += readCount;
+		size -= readCount;
+	}
+	return true;
+}
+sockaddr_un socketAddress() {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	std::string path = getSocketPath();
+	if (path.size() >= sizeof address.sun_path) throw std::runtime_error("socket path is too long");
+	memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	return address;
+}
+// The entries the daemon sends are executed, so only a daemon running as the same user is trusted
+int connectSocket() {
+	sockaddr_un address = socketAddress();
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+	ucred peer;
+	socklen_t peerSize = sizeof peer;
+	if (connect(fd, (sockaddr*)&address, sizeof address) != 0
+			|| getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerSize) != 0 || peer.uid != getuid()) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Without XDG_RUNTIME_DIR the socket lives in /tmp, in a directory that only we can enter
+void prepareSocketDirectory() {
+	if (!getEnviroment("XDG_RUNTIME_DIR"sv).empty()) return;
+	fs::path dir = getSocketPath().parent_path();
+	if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) throw std::runtime_error("cannot create " + dir.native());
+	struct stat st;
+	if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077))
+		throw std::runtime_error(dir.native() + " is not a private directory of this user");
+}
+
+// Fails if a daemon is already running, a stale socket is replaced
+int listenOnSocket() {
+	int runningFd = connectSocket();
+	if (runningFd >= 0) {
+		close(runningFd);
+		throw std::runtime_error("the daemon is already running");
+	}
+
+	prepareSocketDirectory();
+	sockaddr_un address = socketAddress();
+	unlink(address.sun_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) throw std::runtime_error("cannot create the socket");
+	if (bind(fd, (sockaddr*)&address, sizeof address) != 0 || listen(fd, 16) != 0) {
+		close(fd);
+		throw std::runtime_error("cannot listen on " + getSocketPath().native());
+	}
+	return fd;
+}
+}
+
+fs::path getSocketPath() {
+	std::string runtimeDir = getEnviroment("XDG_RUNTIME_DIR"sv);
+	if (!runtimeDir.empty()) return fs::path(runtimeDir) / "desktop-dmenu.sock";
+	return fs::path("/tmp/desktop-dmenu-" + std::to_string(getuid())) / "desktop-dmenu.sock";
+}
+
+// ==========================================
+// MenuDaemon
+// ==========================================
+
+void MenuDaemon::buildMenu() {
+	generation++;
+	menu.clear();
+	renderMenu(entries, icons, iconCache, [this](auto segments) {
+		for (auto segment : segments) menu += segment;
+	});
+	iconCache.save();
+}
+
+void MenuDaemon::handleChanges() {
+	// Changes come in bursts, like a package being installed, so they are collected until the watcher is quiet
+	std::vector<FsWatcher::Event> events;
+	bool complete = watcher.readEvents(events);
+	pollfd watcherFd = { watcher.getFd(), POLLIN, 0 };
+	while (poll(&watcherFd, 1, 100) > 0) complete &= watcher.readEvents(events);
+
+	bool entriesChanged = !complete;
+	bool iconsChanged = !complete;
+	const auto& entryDirs = entries.getDirectories();
+	for (const auto& [ path, isDirectory ] : events) {
+		bool isEntry = std::any_of(begin(entryDirs), end(entryDirs), [&path = path](const auto& dir) {
+			auto relative = path.lexically_relative(dir);
+			return !relative.empty() && *begin(relative) != "..";
+		});
+		if (isEntry) {
+			// Directory changes can affect many entries at once
+			if (isDirectory) entriesChanged = true;
+			else if (!entriesChanged) entries.update(path);
+			continue;
+		}
+		if (isDirectory && std::find(begin(iconDirs), end(iconDirs), path) != end(iconDirs)) iconsChanged = true;
+		if (iconsChanged) continue;
+		if (!isDirectory) icons.updateIcon(path);
+		std::error_code ec;
+		if (isDirectory && fs::is_directory(path, ec))
+			for (const auto& file : fs::directory_iterator(path, ec)) icons.updateIcon(file.path());
+	}
+
+	if (iconsChanged) icons.reindex();
+	if (entriesChanged) entries.rescan();
+	if (!events.empty() || !complete) {
+		entries.persist();
+		buildMenu();
+	}
+}
+
+bool MenuDaemon::handleRequest(std::string& output, std::string_view request) {
+	if (request == "menu") {
+		uint64_t header[2] = { generation, menu.size() };
+		output.append((const char*)header, sizeof header);
+		output += menu;
+		return true;
+	}
+	if (request.substr(0, 6) == "entry ") {
+		uint64_t menuGeneration = 0;
+		int index = -1;
+		const char* end = request.data() + request.size();
+		auto [ next, ec ] = std::from_chars(request.data() + 6, end, menuGeneration);
+		if (ec == std::errc() && next != end && *next == ' ') std::from_chars(next + 1, end, index);
+		// The index is only meaningful in the menu the client showed, the entries may have changed since
+		if (menuGeneration != generation) {
+			uint32_t size = MENU_CHANGED;
+			output.append((const char*)&size, sizeof size);
+			return true;
+		}
+		std::string fields;
+		if (index >= 0 && (size_t)index < entries.size()) {
+			auto entry = entries[index];
+			for (std::string_view field : { entry.getId(), entry.getPath(), entry.getName(),
+					entry.getExec(), entry.getIconId(), entry.needsTerminal() ? "1"sv : "0"sv }) {
+				fields += field;
+				fields += '\0';
+			}
+		}
+		uint32_t size = fields.size();
+		output.append((const char*)&size, sizeof size);
+		output += fields;
+		return true;
+	}
+	return false;
+}
+
+bool MenuDaemon::handleRequests(Client& client) {
+	size_t lineEnd;
+	while (client.output.empty() && (lineEnd = client.input.find('\n')) != std::string::npos) {
+		if (!handleRequest(client.output, std::string_view(client.input).substr(0, lineEnd))) return false;
+		client.input.erase(0, lineEnd + 1);
+		if (!writeClient(client)) return false;
+	}
+	// Requests are short, a client sending long lines is misbehaving
+	return client.input.size() < 1024;
+}
+
+bool MenuDaemon::readClient(Client& client) {
+	char buffer[256];
+	ssize_t readCount = read(client.fd, buffer, sizeof buffer);
+	if (readCount < 0 && (errno == EINTR || errno == EAGAIN)) return true;
+	if (readCount <= 0) return false;
+	client.input.append(buffer, readCount);
+	return handleRequests(client);
+}
+
+// A full socket buffer leaves the rest of the output to be sent on POLLOUT
+bool MenuDaemon::writeClient(Client& client) {
+	size_t sent = 0;
+	while (sent < client.output.size()) {
+		ssize_t written = send(client.fd, client.output.data() + sent, client.output.size() - sent, MSG_NOSIGNAL);
+		if (written < 0 && errno == EINTR) continue;
+		if (written < 0 && errno == EAGAIN) break;
+		if (written <= 0) return false;
+		sent += written;
+	}
+	client.output.erase(0, sent);
+	return true;
+}
+
+MenuDaemon::MenuDaemon() : listenFd(listenOnSocket()), watcher(DesktopEntries::getEntryPaths()) {
+	// The icons are indexed by buildMenu, after their directories are watched
+	iconDirs = icons.getWatchDirs();
+	for (const auto& dir : iconDirs) watcher.watchTree(dir);
+	buildMenu();
+}
+MenuDaemon::~MenuDaemon() {
+	for (auto& client : clients) close(client.fd);
+	if (listenFd >= 0) {
+		close(listenFd);
+		unlink(getSocketPath().c_str());
+	}
+}
+
+void MenuDaemon::run() {
+	std::vector<pollfd> fds;
+	for (;;) {
+		fds.clear();
+		fds.push_back({ listenFd, POLLIN, 0 });
+		fds.push_back({ watcher.getFd(), POLLIN, 0 });
+		for (const auto& client : clients) fds.push_back({ client.fd, short(client.output.empty() ? POLLIN : POLLOUT), 0 });
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR) continue;
+			throw std::runtime_error("poll failed");
+		}
+
+		// The clients are handled first, since accepting changes the client list
+		for (size_t i = clients.size(); i-- > 0;) {
+			short events = fds[i + 2].revents;
+			if (!events) continue;
+			auto& client = clients[i];
+			bool connected = (events & POLLOUT)
+				? writeClient(client) && (!client.output.empty() || handleRequests(client))
+				: readClient(client);
+			if (connected) continue;
+			close(client.fd);
+			clients.erase(begin(clients) + i);
+		}
+		if (fds[1].revents & POLLIN) handleChanges();
+		if (fds[0].revents & POLLIN) {
+			int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd >= 0) clients.push_back({ fd, {}, {} });
+		}
+	}
+}
+
+// ==========================================
+// MenuClient
+// ==========================================
+
+MenuClient::MenuClient() : fd(connectSocket()) {}
+MenuClient::~MenuClient() { if (fd >= 0) close(fd); }
+
+bool MenuClient::isConnected() const { return fd >= 0; }
+
+std::optional<std::string> MenuClient::getMenu() {
+	TRACE_SCOPE("MenuClient::getMenu");
+	uint64_t header[2];
+	if (!writeAll(fd, "menu\n") || !readAll(fd, (char*)header, sizeof header)) return std::nullopt;
+	generation = header[0];
+	std::string menu(header[1], '\0');
+	if (!readAll(fd, menu.data(), menu.size())) return std::nullopt;
+	return menu;
+}
+
+std::optional<DesktopEntry> MenuClient::getEntry(int index, bool& menuChanged) {
+	uint32_t size;
+	menuChanged = false;
+	std::string request = "entry " + std::to_string(generation) + ' ' + std::to_string(index) + '\n';
+	if (!writeAll(fd, request) || !readAll(fd, (char*)&size, sizeof size)) return std::nullopt;
+	menuChanged = size == MENU_CHANGED;
+	if (menuChanged) return std::nullopt;
+	std::string data(size, '\0');
+	if (size == 0 || !readAll(fd, data.data(), size)) return std::nullopt;
+
+	std::vector<std::string_view> fields;
+	for (size_t start = 0, end; (end = data.find('\0', start)) != std::string::npos; start = end + 1)
+		fields.push_back(std::string_view(data).substr(start, end - start));
+	if (fields.size() != 6) return std::nullopt;
+	return DesktopEntry(fields[0], fs::path(fields[1]), fields[2], fields[3], fields[4], fields[5] == "1");
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <optional>
+#include "desktopEntries.hpp"
+#include "fsWatcher.hpp"
+#include "iconBlobCache.hpp"
+#include "icons.hpp"
+#include "utils.hpp"
+
+// The daemon keeps the entries, the icon indexes and the rendered menu in memory and serves them on a
+// unix socket. Changes to the entry and icon directories are applied incrementally through inotify.
+// The protocol is made of newline terminated requests:
+// "menu":                   answered with the u64 generation of the menu, a u64 length and the dmenu payload
+// "entry GENERATION INDEX": answered with a u32 length followed by the NUL separated fields of the entry
+//                           (id, path, name, exec, icon, terminal), the length is 0 if the index is invalid
+//                           and MENU_CHANGED if the menu was rebuilt since that generation
+
+fs::path getSocketPath();
+
+constexpr uint32_t MENU_CHANGED = ~0u;
+
+class MenuDaemon {
+	// Clients are non-blocking, the replies are queued in output and the next request of the client is
+	// only handled once its reply was sent, so a client that doesn't read holds back itself only
+	struct Client {
+		int fd;
+		std::string input;
+		std::string output;
+	};
+
+	// The socket is bound and the entry directories are watched before the entries are scanned,
+	// so a second daemon fails early and no change is missed
+	int listenFd = -1;
+	FsWatcher watcher;
+	DesktopEntries entries;
+	Icons icons;
+	IconBlobCache iconCache;
+	std::string menu;
+	// Incremented every time the menu is rebuilt
+	uint64_t generation = 0;
+	// The theme and pixmaps directories watched, their creation or removal needs a reindex
+	std::vector<fs::path> iconDirs;
+	std::vector<Client> clients;
+
+	void buildMenu();
+	void handleChanges();
+	// Appends the reply to output, returns false when the client should be disconnected
+	bool handleRequest(std::string& output, std::string_view request);
+	// These return false when the client should be disconnected
+	bool handleRequests(Client& client);
+	bool readClient(Client& client);
+	bool writeClient(Client& client);
+public:
+	MenuDaemon();
+	MenuDaemon(const MenuDaemon&) = delete;
+	~MenuDaemon();
+
+	void run();
+};
+
+class MenuClient {
+	int fd = -1;
+	// The generation of the last menu, entries are looked up in it
+	uint64_t generation = 0;
+public:
+	// Connects to the daemon, if it's not running the client is not connected
+	MenuClient();
+	MenuClient(const MenuClient&) = delete;
+	~MenuClient();
+
+	bool isConnected() const;
+	std::optional<std::string> getMenu();
+	// menuChanged is set if the daemon rebuilt the menu since getMenu, the menu has to be shown again
+	std::optional<DesktopEntry> getEntry(int index, bool& menuChanged);
+};
@@ -1,42 +1,195 @@
+#include <cerrno>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <optional>
 #include <stdexcept>
+#include "daemon.hpp"
 #include "desktopEntries.hpp"
+#include "entryList.hpp"
+#include "fuzzyMatch.hpp"
+#include "iconBlobCache.hpp"
 #include "icons.hpp"
+#include "menu.hpp"
 #include "process.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
-DesktopEntry askDesktopEntry(DesktopEntries& entries, Icons& icons) {
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Runs dmenu, writeMenu has to write the menu and can send EOF itself to do some work while dmenu is open
+int askDmenu(const std::function<void(detail::iopipes&)>& writeMenu) {
 	Process dmenu("dmenu", DMENU_ARGS);
 	dmenu.run();
-	for (const auto& entry : entries) {
-		auto icon = icons.queryIconClosestSize(entry.getIconId(), 16);
-		dmenu.stream() << entry.getName();
-		if (icon) {
-			dmenu.stream().write("\0", 1);
-			dmenu.stream() << icon->dmenuString();
-		}
-		dmenu.stream() << '\n';
-	}
+	writeMenu(dmenu.stream());
 	dmenu.stream().sendEOF();
 	std::string output;
-	std::getline(dmenu.stream(), output);
+	{
+		TRACE_SCOPE("dmenu");
+		std::getline(dmenu.stream(), output);
+	}
 
-	if (dmenu.join() != 0) exit(1);
+	int status = dmenu.join();
+	Tracer::finish();
+	Stats::report();
+	if (status != 0) exit(1);
+	// dmenu can't have shown every entry, so its answer may not be what the user meant
+	if (dmenu.stream().bad()) throw std::runtime_error("the menu could not be written to dmenu");
 
-	int index = std::stoi(output);
-	return entries[index];
+	return std::stoi(output);
 }
 
-int main(int argc, const char* argv[]) {
+DesktopEntry askDesktopEntry(const std::vector<DesktopEntryView>& entries, Icons& icons) {
+	IconBlobCache iconCache;
+	int index = askDmenu([&](detail::iopipes& stream) {
+		renderMenu(entries, icons, iconCache, [&stream](auto segments) { stream.writeSegments(segments); });
+		stream.sendEOF();
+		iconCache.save();
+	});
+	return DesktopEntry(entries[index]);
+}
+
+std::optional<DesktopEntry> askDaemonEntry(MenuClient& client) {
+	bool menuChanged;
+	do {
+		auto menu = client.getMenu();
+		if (!menu) return std::nullopt;
+		int index = askDmenu([&menu](detail::iopipes& stream) { stream.writeSegments({ *menu }); });
+		auto entry = client.getEntry(index, menuChanged);
+		if (entry) return entry;
+	} while (menuChanged);
+	return std::nullopt;
+}
+
+namespace {
+// ioprio_set has no glibc wrapper, the constants come from linux/ioprio.h
+constexpr int IOPRIO_WHO_PROCESS = 1;
+constexpr int IOPRIO_CLASS_IDLE = 3;
+constexpr int IOPRIO_CLASS_SHIFT = 13;
+}
+
+// Rebuilds the entry cache and renders every icon payload into the icon cache, so that the next menu opens
+// with warm caches. The theme indexes have no persistent form, rendering only pulls their files into the
+// page cache. Runs at idle I/O priority and WARM_NICE to stay out of the way of the session, the threads
+// started afterwards inherit both. Failing to lower the priorities is reported, the caches are warmed anyway.
+void warmCaches() {
+	if (setpriority(PRIO_PROCESS, 0, WARM_NICE) != 0)
+		std::cerr << "Cannot set the nice level: " << strerror(errno) << '\n';
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+		std::cerr << "Cannot set the I/O priority: " << strerror(errno) << '\n';
+
 	DesktopEntries entries;
 	Icons icons;
+	IconBlobCache iconCache;
+	renderMenu(entries, icons, iconCache, [](auto) {});
+	iconCache.save();
+	Tracer::finish();
+	Stats::report();
+}
+
+enum class QueryMode { PRINT, LAUNCH, MENU };
+
+// Matches query against the entries without dmenu, returns the entry to launch if there is one
+std::optional<DesktopEntry> runQuery(std::string_view query, QueryMode mode) {
+	DesktopEntries entries;
+	FuzzyMatcher matcher(entries);
+	size_t limit = mode == QueryMode::LAUNCH ? 1 : mode == QueryMode::PRINT && QUERY_RESULTS ? QUERY_RESULTS : entries.size();
+	auto matches = matcher.filter(query, limit);
+	if (matches.empty()) {
+		std::cerr << "No entry matches " << query << '\n';
+		exit(1);
+	}
+
+	if (mode == QueryMode::MENU) {
+		// Only the matches are sent to dmenu, so only their icons are rendered
+		std::vector<DesktopEntryView> views;
+		for (uint32_t index : matches) views.push_back(entries[index]);
+		Icons icons;
+		return askDesktopEntry(views, icons);
+	}
+	Tracer::finish();
+	Stats::report();
+	if (mode == QueryMode::LAUNCH) return DesktopEntry(entries[matches[0]]);
+	for (uint32_t index : matches) std::cout << entries[index].getId() << '\t' << entries[index].getName() << '\n';
+	return std::nullopt;
+}
+
+int main(int argc, const char* argv[]) {
+	bool daemon = false;
+	bool warm = false;
+	std::optional<ListFormat> listFormat;
+	bool iconPaths = false;
+	std::optional<std::string_view> query;
+	QueryMode queryMode = QueryMode::PRINT;
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg == "--daemon") daemon = true;
+		else if (arg == "--warm") warm = true;
+		else if (arg == "--list") listFormat = ListFormat::NUL;
+		else if (arg == "--list=json") listFormat = ListFormat::JSON;
+		else if (arg == "--icon-paths") iconPaths = true;
+		else if (arg == "--query" && i + 1 < argc) query = argv[++i];
+		else if (arg.substr(0, 8) == "--query=") query = arg.substr(8);
+		else if (arg == "--launch") queryMode = QueryMode::LAUNCH;
+		else if (arg == "--menu") queryMode = QueryMode::MENU;
+		else if (arg.substr(0, 8) == "--trace=") Tracer::start(arg.substr(8));
+		else if (arg == "--stats") Stats::enableReport(Stats::Format::TEXT);
+		else if (arg == "--stats=json") Stats::enableReport(Stats::Format::JSON);
+		else {
+			std::cerr << "Unknown option: " << arg << '\n';
+			return 1;
+		}
+	}
 
-	DesktopEntry e = askDesktopEntry(entries, icons);
+	if (listFormat) {
+		// The entries come from the entry cache when it's valid, the icons are only looked up if asked for
+		DesktopEntries entries;
+		std::optional<Icons> icons;
+		if (iconPaths) icons.emplace();
+		writeEntryList(STDOUT_FILENO, entries, *listFormat, icons ? &*icons : nullptr);
+		Tracer::finish();
+		Stats::report();
+		return 0;
+	}
+	if (warm) {
+		warmCaches();
+		return 0;
+	}
+	if (daemon) {
+		MenuDaemon menuDaemon;
+		// The trace and the stats of the daemon cover its startup
+		Tracer::finish();
+		Stats::report();
+		menuDaemon.run();
+		return 0;
+	}
+
+	if (queryMode != QueryMode::PRINT && !query) {
+		std::cerr << "--launch and --menu need --query\n";
+		return 1;
+	}
+
+	std::optional<DesktopEntry> e;
+	if (query) {
+		e = runQuery(*query, queryMode);
+		if (!e) return 0;
+	} else {
+		MenuClient client;
+		if (client.isConnected()) e = askDaemonEntry(client);
+		if (!e) {
+			DesktopEntries entries;
+			Icons icons;
+			e = askDesktopEntry(std::vector<DesktopEntryView>(::begin(entries), ::end(entries)), icons);
+		}
+	}
 
-	std::string parsedExec;
-	auto [ cmd, args ] = e.getCommand(parsedExec);
-	args.push_back(parsedExec);
-	Process p(cmd, args);
+	// The program is executed directly, without a shell parsing the command again
+	auto command = e->getCommand();
+	std::vector<std::string_view> args(::begin(command) + 1, ::end(command));
+	Process p(command[0], args);
 	p.exec();
 	throw std::runtime_error("Cannot exec program");
 }
@@ -1,11 +1,21 @@
 #include "desktopEntries.hpp"
 #include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
 #include <iterator>
 #include <optional>
 #include <iterator>
 #include <utility>
 
+#include <fcntl.h>
+
+#include "entryCache.hpp"
+#include "fileReader.hpp"
 #include "iniParse.hpp"
+#include "threadPool.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 // https://specifications.freedesktop.org/desktop-entry-spec/desktop-entry-spec-latest.html
@@ -24,19 +34,12 @@ std::string DesktopEntry::pathToId(const fs::path& base, const fs::path& path) {
 	id += *last;
 	return id;
 }
-DesktopEntry::DesktopEntry(std::string_view id) : id(id) {}
-DesktopEntry::DesktopEntry(const fs::path& base, const fs::path& path) : path(path), id(pathToId(base, path)) {
-	iniFile desktopFile(path.native());
-	auto section = std::find(::begin(desktopFile), ::end(desktopFile), "Desktop Entry"sv);
-	for (const auto& [ ename, value ] : section->entries) {
-		if (ename == "Name") name = value;
-		else if (ename == "Icon") icon = value;
-		else if (ename == "Exec") exec = value;
-		else if (ename == "Terminal") useTerminal = value == "true";
-		else if (ename == "NoDisplay") hidden |= value == "true";
-		else if (ename == "Hidden") hidden |= value == "true";
-	}
-}
+DesktopEntry::DesktopEntry(const DesktopEntryView& view) :
+	id(view.getId()), path(view.getPath()), name(view.getName()), exec(view.getExec()), icon(view.getIconId()),
+	useTerminal(view.needsTerminal()) {}
+DesktopEntry::DesktopEntry(std::string_view id, const fs::path& path, std::string_view name,
+		std::string_view exec, std::string_view icon, bool useTerminal) :
+	id(id), path(path), name(name), exec(exec), icon(icon), useTerminal(useTerminal) {}
 
 std::string_view DesktopEntry::getId() const { return id; }
 const fs::path& DesktopEntry::getPath() const { return path; }
@@ -44,58 +47,135 @@ std::string_view DesktopEntry::getName() const { return name; }
 std::string_view DesktopEntry::getExec() const { return exec; }
 std::string_view DesktopEntry::getIconId() const { return icon; }
 bool DesktopEntry::needsTerminal() const { return useTerminal; }
-bool DesktopEntry::isHidden() const { return hidden; }
-
-std::pair<std::string_view, std::vector<std::string_view>> const DesktopEntry::getCommand(std::string& parsedExec) {
-	parsedExec.clear();
-	bool escape = false;
-	for (char c : exec) {
-		if (!escape) {
-			if (c == '%') escape = true;
-			else parsedExec += c;
+
+namespace {
+// Exec is a string value, so its escapes (like "\\s" for a space) are decoded before the quoting rules apply
+std::string unescapeString(std::string_view value) {
+	std::string out;
+	out.reserve(value.size());
+	for (size_t i = 0; i < value.size(); i++) {
+		if (value[i] != '\\' || i + 1 == value.size()) {
+			out += value[i];
+			continue;
+		}
+		switch (value[++i]) {
+		case 's': out += ' '; break;
+		case 'n': out += '\n'; break;
+		case 't': out += '\t'; break;
+		case 'r': out += '\r'; break;
+		case '\\': out += '\\'; break;
+		default: out += '\\'; out += value[i]; break;
+		}
+	}
+	return out;
+}
+
+// Arguments are separated by spaces, an argument in double quotes can contain spaces and
+// escapes '"', '`', '$' and '\\' with a backslash
+std::vector<std::string> splitArguments(std::string_view exec) {
+	std::vector<std::string> args;
+	std::string arg;
+	bool inArg = false, quoted = false;
+	for (size_t i = 0; i < exec.size(); i++) {
+		char c = exec[i];
+		if (quoted) {
+			if (c == '"') quoted = false;
+			else if (c == '\\' && i + 1 < exec.size() && std::strchr("\"`$\\", exec[i + 1])) arg += exec[++i];
+			else arg += c;
+		} else if (c == ' ' || c == '\t' || c == '\n') {
+			if (inArg) args.push_back(std::move(arg));
+			arg.clear();
+			inArg = false;
 		} else {
-			switch (c) {
-			case '%':
-				parsedExec += '%';
-				break;
-			case 'f':
-			case 'F':
-			case 'u':
-			case 'U':
-				break;
-			case 'i':
-				parsedExec += "--icon '" + icon + '\'';
-				break;
-			case 'c':
-				parsedExec += name;
-				break;
-			case 'k':
-				parsedExec += path.native();
-				break;
-			default: break;
-			}
-			escape = false;
+			inArg = true;
+			if (c == '"') quoted = true;
+			else arg += c;
 		}
 	}
+	if (quoted) throw std::runtime_error("Unterminated quote in Exec");
+	if (inArg) args.push_back(std::move(arg));
+	return args;
+}
+}
 
-	std::vector<std::string_view> args = useTerminal ? TERMINAL_ARGS : SHELL_ARGS;
-	std::string_view cmd = useTerminal ? TERMINAL : SHELL;
+std::vector<std::string> DesktopEntry::getCommand() const {
+	std::vector<std::string> argv;
+	if (useTerminal) {
+		argv.emplace_back(TERMINAL);
+		argv.insert(::end(argv), ::begin(TERMINAL_ARGS), ::end(TERMINAL_ARGS));
+	}
 
-	return { cmd, args };
-}
+	for (auto& arg : splitArguments(unescapeString(exec))) {
+		// %i expands to two arguments, the file and url codes expand to nothing since no files are passed
+		if (arg == "%i") {
+			if (!icon.empty()) {
+				argv.emplace_back("--icon");
+				argv.push_back(icon);
+			}
+			continue;
+		}
+		if (arg.size() == 2 && arg[0] == '%' && std::strchr("fFuUdDnNvm", arg[1])) continue;
 
-bool DesktopEntry::operator==(const DesktopEntry& other) const { return id == other.id; }
-bool DesktopEntry::operator!=(const DesktopEntry& other) const { return !(operator==(other)); }
+		std::string expanded;
+		for (size_t i = 0; i < arg.size(); i++) {
+			if (arg[i] != '%' || i + 1 == arg.size()) {
+				expanded += arg[i];
+				continue;
+			}
+			switch (arg[++i]) {
+			case '%': expanded += '%'; break;
+			case 'i': expanded += icon; break;
+			case 'c': expanded += name; break;
+			case 'k': expanded += path.native(); break;
+			default: break;
+			}
+		}
+		argv.push_back(std::move(expanded));
+	}
+	if (argv.size() == (useTerminal ? TERMINAL_ARGS.size() + 1 : 0)) throw std::runtime_error("Empty Exec");
+	return argv;
+}
 
 // ==========================================
 // DesktopEntries
 // ==========================================
 
+namespace {
+// A parsed .desktop file, the fields are views into the file so parsing allocates no strings
+struct ParsedEntry {
+	iniFile file;
+	std::string_view name, exec, icon, keywords;
+	bool useTerminal = false;
+	bool hidden = false;
+
+	ParsedEntry(const fs::path& path) : ParsedEntry(iniFile(path.native())) {}
+	ParsedEntry(iniFile parsedFile) : file(std::move(parsedFile)) {
+		Stats::add(Stats::ENTRIES_PARSED);
+		auto section = std::find(::begin(file), ::end(file), "Desktop Entry"sv);
+		if (section == ::end(file)) {
+			hidden = true;
+			return;
+		}
+		for (const auto& [ ename, value ] : section->entries) {
+			if (ename == "Name") name = value;
+			else if (ename == "Icon") icon = value;
+			else if (ename == "Exec") exec = value;
+			else if (ename == "Keywords") keywords = value;
+			else if (ename == "Terminal") useTerminal = value == "true";
+			else if (ename == "NoDisplay") hidden |= value == "true";
+			else if (ename == "Hidden") hidden |= value == "true";
+		}
+	}
+	size_t stringBytes() const { return name.size() + exec.size() + icon.size() + keywords.size(); }
+};
+}
+
 std::string DesktopEntries::getEnviroment(std::string_view name) {
 	char* val = getenv(name.data());
 	return val ? val : ""s;
 }
 std::vector<fs::path> DesktopEntries::getEntryPaths() {
+	TRACE_SCOPE("DesktopEntries::getEntryPaths");
 	std::string data_dirs = getEnviroment("XDG_DATA_DIRS"sv);
 	std::vector<fs::path> out;
 	if (!data_dirs.empty()) {
@@ -116,26 +196,144 @@ std::vector<fs::path> DesktopEntries::getEntryPaths() {
 	return out;
 }
 
-std::vector<DesktopEntry> DesktopEntries::getDesktopEntries(const std::vector<fs::path> entryPaths) {
-	std::vector<DesktopEntry> out;
-	for (const auto& entryDirectory : entryPaths) {
-		if (!fs::exists(entryDirectory)) continue;
-		auto diriter = fs::recursive_directory_iterator(entryDirectory);
-		for (const auto& file : diriter) {
-			const auto path = file.path();
-			if (!file.is_regular_file() || path.extension() != ".desktop") continue;
-			DesktopEntry entry(entryDirectory, path);
-			if (!entry.isHidden() && std::find(::begin(out), ::end(out), entry) == ::end(out))
-				out.emplace_back(std::move(entry));
+EntryTable DesktopEntries::getDesktopEntries(const std::vector<fs::path> entryPaths, std::vector<CachedDirectory>& scannedDirs, unsigned threads) {
+	TRACE_SCOPE("DesktopEntries::getDesktopEntries");
+	// With io_uring the files are read in batches once they are all found and parsed by the pool as the reads
+	// complete, otherwise the pool reads and parses each file as it's found. Every file gets a slot in enumeration
+	// order so that the merge below sees them in the same order as a serial scan.
+	struct Slot {
+		fs::path path;
+		const fs::path* base;
+		std::unique_ptr<char[]> data;
+		size_t size;
+		std::optional<ParsedEntry> parsed;
+	};
+	std::deque<Slot> parsed;
+	bool batched = FileReader::local().getBackend() == FileReader::Backend::IO_URING;
+	{
+		ThreadPool pool(threads);
+		// The mtimes are taken before reading the directories, so a concurrent change invalidates the cache
+		for (const auto& entryDirectory : entryPaths)
+			scannedDirs.push_back({ entryDirectory, getMtime(entryDirectory) });
+		for (const auto& entryDirectory : entryPaths) {
+			Stats::add(Stats::FILES_STATED);
+			if (!fs::exists(entryDirectory)) continue;
+			Stats::add(Stats::DIRECTORIES_READ);
+			auto diriter = fs::recursive_directory_iterator(entryDirectory);
+			for (const auto& file : diriter) {
+				const auto& path = file.path();
+				if (file.is_directory()) {
+					Stats::add(Stats::DIRECTORIES_READ);
+					scannedDirs.push_back({ path, getMtime(path) });
+				}
+				if (!file.is_regular_file() || path.extension() != ".desktop") continue;
+				auto& slot = parsed.emplace_back(Slot{ path, &entryDirectory, nullptr, 0, std::nullopt });
+				if (batched) continue;
+				pool.submit([&slot] {
+					TRACE_SCOPE("parse entry", slot.path.native());
+					try {
+						slot.parsed.emplace(slot.path);
+					} catch (const std::exception&) {}
+				});
+			}
+		}
+
+		if (batched) {
+			std::vector<FileRequest> requests;
+			requests.reserve(parsed.size());
+			for (const auto& slot : parsed) requests.push_back({ AT_FDCWD, slot.path.native() });
+			FileReader::local().readFiles(requests, [&pool, &parsed](size_t index, std::unique_ptr<char[]> data, size_t size) {
+				auto& slot = parsed[index];
+				slot.data = std::move(data);
+				slot.size = size;
+				pool.submit([&slot] {
+					TRACE_SCOPE("parse entry", slot.path.native());
+					try {
+						slot.parsed.emplace(iniFile(std::move(slot.data), slot.size));
+					} catch (const std::exception&) {}
+				});
+			});
 		}
+		pool.wait();
 	}
-	std::sort(::begin(out), ::end(out), [](const auto& a, const auto& b){
-			return a.getName() < b.getName();
-	});
+
+	// The strings of every file are reserved up front, duplicates included, so the arena is allocated once
+	size_t stringBytes = 0;
+	for (const auto& slot : parsed)
+		if (slot.parsed) stringBytes += slot.path.native().size() * 2 + slot.parsed->stringBytes();
+	EntryTable out;
+	out.reserve(parsed.size(), stringBytes);
+	for (const auto& slot : parsed) {
+		if (!slot.parsed || slot.parsed->hidden) continue;
+		const auto& entry = *slot.parsed;
+		out.add(DesktopEntry::pathToId(*slot.base, slot.path), slot.path.native(), entry.name, entry.exec, entry.icon, entry.keywords, entry.useTerminal);
+	}
+	out.sort();
 	return out;
 }
 
-DesktopEntries::DesktopEntries() : entries(getDesktopEntries(getEntryPaths())) {}
-std::vector<DesktopEntry>::const_iterator DesktopEntries::begin() const { return ::begin(entries); }
-std::vector<DesktopEntry>::const_iterator DesktopEntries::end() const { return ::end(entries); }
-DesktopEntry DesktopEntries::operator[](int i) const { return entries[i]; }
+namespace {
+// Every '-' in an id can come from a directory separator, so an id maps to 2^dashes possible paths
+std::vector<fs::path> idToPaths(const fs::path& base, std::string_view id) {
+	std::vector<size_t> dashes;
+	for (size_t i = 0; i < id.size(); i++)
+		if (id[i] == '-') dashes.push_back(i);
+	std::vector<fs::path> paths;
+	std::string relative(id);
+	for (uint32_t mask = 0; mask < (1u << dashes.size()); mask++) {
+		for (size_t i = 0; i < dashes.size(); i++) relative[dashes[i]] = mask & (1u << i) ? '/' : '-';
+		paths.push_back(base / relative);
+	}
+	return paths;
+}
+}
+
+void DesktopEntries::resolveId(const std::string& id) {
+	entries.remove(id);
+	for (const auto& entryDirectory : entryPaths) {
+		for (const auto& path : idToPaths(entryDirectory, id)) {
+			std::error_code ec;
+			if (!fs::is_regular_file(path, ec)) continue;
+			ParsedEntry entry(path);
+			if (entry.hidden) continue;
+			entries.insertSorted(id, path.native(), entry.name, entry.exec, entry.icon, entry.keywords, entry.useTerminal);
+			return;
+		}
+	}
+}
+
+DesktopEntries::DesktopEntries(unsigned threads) : entryPaths(getEntryPaths()), threads(threads) {
+	EntryCache cache;
+	{
+		TRACE_SCOPE("EntryCache::load");
+		if (cache.load(entryPaths, scannedDirs, entries)) return;
+	}
+	rescan();
+	TRACE_SCOPE("EntryCache::store");
+	cache.store(entryPaths, scannedDirs, entries);
+}
+
+const std::vector<fs::path>& DesktopEntries::getDirectories() const { return entryPaths; }
+void DesktopEntries::update(const fs::path& file) {
+	auto entryDirectory = std::find_if(::begin(entryPaths), ::end(entryPaths), [&file](const auto& dir) {
+		auto relative = file.lexically_relative(dir);
+		return !relative.empty() && *::begin(relative) != "..";
+	});
+	if (entryDirectory == ::end(entryPaths) || file.extension() != ".desktop") return;
+	std::string id = DesktopEntry::pathToId(*entryDirectory, file);
+	// Ids with many dashes have too many candidate paths to probe
+	if (std::count(::begin(id), ::end(id), '-') > 8) rescan();
+	else resolveId(id);
+}
+void DesktopEntries::rescan() {
+	scannedDirs.clear();
+	entries = getDesktopEntries(entryPaths, scannedDirs, threads);
+}
+bool DesktopEntries::persist() {
+	for (auto& dir : scannedDirs) dir.mtime = getMtime(dir.path);
+	return EntryCache().store(entryPaths, scannedDirs, entries);
+}
+EntryTable::const_iterator DesktopEntries::begin() const { return entries.begin(); }
+EntryTable::const_iterator DesktopEntries::end() const { return entries.end(); }
+size_t DesktopEntries::size() const { return entries.size(); }
+DesktopEntryView DesktopEntries::operator[](int i) const { return entries[i]; }
@@ -2,10 +2,13 @@
 
 #include <iterator>
 #include <utility>
+#include "cacheFile.hpp"
+#include "entryTable.hpp"
 #include "utils.hpp"
 
 // https://specifications.freedesktop.org/desktop-entry-spec/desktop-entry-spec-latest.html
 
+// An entry that owns its fields, used once an entry was picked
 class DesktopEntry {
 	std::string id;
 	std::filesystem::path path;
@@ -13,13 +16,13 @@ class DesktopEntry {
 	std::string name;
 	std::string exec;
 	std::string icon;
-	bool useTerminal;
-	bool hidden = false;
-
-	std::string pathToId(const std::filesystem::path& base, const std::filesystem::path& path);
+	bool useTerminal = false;
 public:
-	DesktopEntry(std::string_view id);
-	DesktopEntry(const std::filesystem::path& base, const std::filesystem::path& path);
+	static std::string pathToId(const std::filesystem::path& base, const std::filesystem::path& path);
+
+	DesktopEntry(const DesktopEntryView& view);
+	DesktopEntry(std::string_view id, const std::filesystem::path& path, std::string_view name,
+			std::string_view exec, std::string_view icon, bool useTerminal);
 
 	std::string_view getId() const;
 	const std::filesystem::path& getPath() const;
@@ -27,25 +30,39 @@ public:
 	std::string_view getExec() const;
 	std::string_view getIconId() const;
 	bool needsTerminal() const;
-	bool isHidden() const;
-
-	std::pair<std::string_view, std::vector<std::string_view>> const getCommand(std::string& parsedExec);
 
-	bool operator==(const DesktopEntry& other) const;
-	bool operator!=(const DesktopEntry& other) const;
+	// The argv that launches the entry: Exec split into arguments with the field codes expanded,
+	// prefixed by the terminal if the entry needs one
+	std::vector<std::string> getCommand() const;
 };
 
 class DesktopEntries {
-	std::vector<DesktopEntry> entries;
+	std::vector<std::filesystem::path> entryPaths;
+	std::vector<CachedDirectory> scannedDirs;
+	unsigned threads;
+	EntryTable entries;
 
-	std::string getEnviroment(std::string_view name);
-	std::vector<std::filesystem::path> getEntryPaths();
+	static std::string getEnviroment(std::string_view name);
 
-	std::vector<DesktopEntry> getDesktopEntries(const std::vector<std::filesystem::path> entryPaths);
+	EntryTable getDesktopEntries(const std::vector<std::filesystem::path> entryPaths, std::vector<CachedDirectory>& scannedDirs, unsigned threads);
+	void resolveId(const std::string& id);
 
 public:
-	DesktopEntries();
-	std::vector<DesktopEntry>::const_iterator begin() const;
-	std::vector<DesktopEntry>::const_iterator end() const;
-	DesktopEntry operator[](int i) const;
+	DesktopEntries(unsigned threads = WORKER_THREADS);
+
+	// The directories the entries are read from, known before they are scanned
+	static std::vector<std::filesystem::path> getEntryPaths();
+
+	const std::vector<std::filesystem::path>& getDirectories() const;
+	// Re-reads the entry with the id of file after it was created, modified or deleted,
+	// the entry order and the precedence between the directories are kept
+	void update(const std::filesystem::path& file);
+	void rescan();
+	// Stores the current entries in the entry cache, keyed by the current directory mtimes
+	bool persist();
+
+	EntryTable::const_iterator begin() const;
+	EntryTable::const_iterator end() const;
+	size_t size() const;
+	DesktopEntryView operator[](int i) const;
 };
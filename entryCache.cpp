@@ -0,0 +1,100 @@
+#include "entryCache.hpp"
+#include <cstring>
+
+#include "cacheFile.hpp"
+#include "utils.hpp"
+
+// The cache file is laid out as: Header | DirRecord[dirCount] | EntryRecord[entryCount] | strings
+// The first rootCount directories are the entry paths in order, the rest are their subdirectories
+
+namespace {
+constexpr char MAGIC[8] = { 'D', 'D', 'M', 'E', 'N', 'T', 'R', 'Y' };
+constexpr uint32_t VERSION = 2;
+
+struct Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t rootCount;
+	uint32_t dirCount;
+	uint32_t entryCount;
+	uint32_t stringsSize;
+	uint32_t reserved;
+};
+struct DirRecord {
+	StrRef path;
+	int64_t mtime;
+};
+struct EntryRecord {
+	StrRef id, path, name, exec, icon, keywords;
+	uint32_t flags;
+};
+enum EntryFlags : uint32_t { FLAG_TERMINAL = 1 };
+}
+
+EntryCache::EntryCache() : cachePath(getCacheDir() / "entries") {}
+EntryCache::EntryCache(fs::path cachePath) : cachePath(std::move(cachePath)) {}
+
+bool EntryCache::load(const std::vector<fs::path>& entryPaths, std::vector<CachedDirectory>& dirs, EntryTable& entries) const {
+	MappedFile file(cachePath);
+	const Header* header = file.at<Header>(0);
+	if (!header || memcmp(header->magic, MAGIC, sizeof MAGIC) != 0 || header->version != VERSION) return false;
+	if (header->rootCount != entryPaths.size() || header->rootCount > header->dirCount) return false;
+
+	size_t offset = sizeof(Header);
+	const DirRecord* dirRecords = file.at<DirRecord>(offset, header->dirCount);
+	offset += header->dirCount * sizeof(DirRecord);
+	const EntryRecord* records = file.at<EntryRecord>(offset, header->entryCount);
+	offset += header->entryCount * sizeof(EntryRecord);
+	const char* stringData = file.at<char>(offset, header->stringsSize);
+	if (!dirRecords || !records || !stringData) return false;
+	std::string_view strings(stringData, header->stringsSize);
+
+	for (uint32_t i = 0; i < header->dirCount; i++) {
+		std::string_view path = resolve(strings, dirRecords[i].path);
+		if (i < header->rootCount && path != entryPaths[i].native()) return false;
+		if (getMtime(path) != dirRecords[i].mtime) return false;
+	}
+
+	dirs.clear();
+	dirs.reserve(header->dirCount);
+	for (uint32_t i = 0; i < header->dirCount; i++)
+		dirs.push_back({ resolve(strings, dirRecords[i].path), dirRecords[i].mtime });
+
+	// The entries are stored sorted and deduplicated, the string table bounds the size of their strings
+	entries.clear();
+	entries.reserve(header->entryCount, header->stringsSize);
+	for (uint32_t i = 0; i < header->entryCount; i++) {
+		const auto& r = records[i];
+		entries.add(resolve(strings, r.id), resolve(strings, r.path), resolve(strings, r.name),
+				resolve(strings, r.exec), resolve(strings, r.icon), resolve(strings, r.keywords), r.flags & FLAG_TERMINAL);
+	}
+	return true;
+}
+
+bool EntryCache::store(const std::vector<fs::path>& entryPaths, const std::vector<CachedDirectory>& dirs, const EntryTable& entries) const {
+	StringTable strings;
+	std::vector<DirRecord> dirRecords;
+	dirRecords.reserve(dirs.size());
+	for (const auto& dir : dirs)
+		dirRecords.push_back({ strings.add(dir.path.native()), dir.mtime });
+
+	std::vector<EntryRecord> entryRecords;
+	entryRecords.reserve(entries.size());
+	for (const auto& entry : entries) {
+		entryRecords.push_back({
+			strings.add(entry.getId()), strings.add(entry.getPath()), strings.add(entry.getName()),
+			strings.add(entry.getExec()), strings.add(entry.getIconId()), strings.add(entry.getKeywords()),
+			entry.needsTerminal() ? FLAG_TERMINAL : 0u
+		});
+	}
+
+	Header header = {};
+	memcpy(header.magic, MAGIC, sizeof MAGIC);
+	header.version = VERSION;
+	header.rootCount = entryPaths.size();
+	header.dirCount = dirRecords.size();
+	header.entryCount = entryRecords.size();
+	header.stringsSize = strings.size();
+
+	return writeFileAtomic(cachePath, { asBytes(header), asBytes(dirRecords), asBytes(entryRecords), strings.view() });
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "cacheFile.hpp"
+#include "entryTable.hpp"
+
+// Persistent cache of the sorted and deduplicated desktop entries.
+// The cache is keyed by the list of entry directories and the mtimes of every directory that was
+// scanned (subdirectories included), adding, removing or renaming a file changes those mtimes.
+class EntryCache {
+	fs::path cachePath;
+public:
+	EntryCache();
+	EntryCache(fs::path cachePath);
+
+	// Fills entries and dirs if the cache is valid for entryPaths
+	bool load(const std::vector<fs::path>& entryPaths, std::vector<CachedDirectory>& dirs, EntryTable& entries) const;
+	bool store(const std::vector<fs::path>& entryPaths, const std::vector<CachedDirectory>& dirs, const EntryTable& entries) const;
+};
@@ -0,0 +1,69 @@
+#include "entryList.hpp"
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "trace.hpp"
+#include "utils.hpp"
+
+namespace {
+constexpr size_t BATCH_SIZE = 64 * 1024;
+// The ASCII unit separator, it can't appear in the single line values of a desktop file in practice
+constexpr char FIELD_SEPARATOR = '\x1f';
+
+void writeAll(int fd, std::string_view data) {
+	while (!data.empty()) {
+		ssize_t written = write(fd, data.data(), data.size());
+		if (written < 0 && errno == EINTR) continue;
+		if (written < 0) throw std::runtime_error("Cannot write the entry list: "s + strerror(errno));
+		data.remove_prefix(written);
+	}
+}
+}
+
+void writeEntryList(int fd, const DesktopEntries& entries, ListFormat format, Icons* icons) {
+	TRACE_SCOPE("writeEntryList");
+	if (icons) {
+		std::vector<std::string_view> names;
+		for (auto entry : entries) names.push_back(entry.getIconId());
+		icons->prepare(names);
+	}
+
+	std::string buffer;
+	buffer.reserve(BATCH_SIZE + 4096);
+	std::string iconPath;
+	for (auto entry : entries) {
+		std::string_view icon = entry.getIconId();
+		if (icons) {
+			auto found = icons->queryIconClosestSize(icon, 16);
+			iconPath = found ? found->getPath().native() : "";
+			icon = iconPath;
+		}
+
+		if (format == ListFormat::NUL) {
+			for (auto field : { entry.getId(), entry.getName(), entry.getExec(), icon }) {
+				buffer += field;
+				buffer += FIELD_SEPARATOR;
+			}
+			buffer += entry.needsTerminal() ? "1"sv : "0"sv;
+			buffer += '\0';
+		} else {
+			buffer += "{\"id\":";
+			appendJsonString(buffer, entry.getId());
+			buffer += ",\"name\":";
+			appendJsonString(buffer, entry.getName());
+			buffer += ",\"exec\":";
+			appendJsonString(buffer, entry.getExec());
+			buffer += ",\"icon\":";
+			appendJsonString(buffer, icon);
+			buffer += entry.needsTerminal() ? ",\"terminal\":true}\n" : ",\"terminal\":false}\n";
+		}
+
+		if (buffer.size() >= BATCH_SIZE) {
+			writeAll(fd, buffer);
+			buffer.clear();
+		}
+	}
+	writeAll(fd, buffer);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "desktopEntries.hpp"
+#include "icons.hpp"
+#include "utils.hpp"
+
+// Exports the entries, in menu order, for other launchers and scripts. A record holds the id, the name,
+// the exec, the icon and the terminal flag. In the NUL format every record ends with a NUL and its fields
+// are separated by 0x1f, so "fzf --read0 --delimiter=$'\x1f' --with-nth=2" shows the names.
+// In the JSON format every record is an object on its own line.
+// The records are collected in a buffer that is written whenever it's full, the icons are never decoded.
+
+enum class ListFormat { NUL, JSON };
+
+// With icons the icon field is the path of the icon closest to 16 pixels, otherwise the Icon value of the entry
+void writeEntryList(int fd, const DesktopEntries& entries, ListFormat format, Icons* icons = nullptr);
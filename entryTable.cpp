@@ -0,0 +1,162 @@
+#include "entryTable.hpp"
+#include <algorithm>
+
+#include "utils.hpp"
+
+// ==========================================
+// DesktopEntryView
+// ==========================================
+
+DesktopEntryView::DesktopEntryView(const EntryTable* table, uint32_t slot) : table(table), slot(slot) {}
+std::string_view DesktopEntryView::getId() const { return resolve(table->arena, table->ids[slot]); }
+std::string_view DesktopEntryView::getPath() const { return resolve(table->arena, table->paths[slot]); }
+std::string_view DesktopEntryView::getName() const { return resolve(table->arena, table->names[slot]); }
+std::string_view DesktopEntryView::getExec() const { return resolve(table->arena, table->execs[slot]); }
+std::string_view DesktopEntryView::getIconId() const { return resolve(table->arena, table->icons[slot]); }
+std::string_view DesktopEntryView::getKeywords() const { return resolve(table->arena, table->keywords[slot]); }
+bool DesktopEntryView::needsTerminal() const { return table->terminal[slot]; }
+
+// ==========================================
+// EntryTable::const_iterator
+// ==========================================
+
+EntryTable::const_iterator::const_iterator(const EntryTable* table, std::vector<uint32_t>::const_iterator position) :
+	table(table), position(position) {}
+DesktopEntryView EntryTable::const_iterator::operator*() const { return { table, *position }; }
+EntryTable::const_iterator& EntryTable::const_iterator::operator++() {
+	++position;
+	return *this;
+}
+bool EntryTable::const_iterator::operator==(const const_iterator& other) const { return position == other.position; }
+bool EntryTable::const_iterator::operator!=(const const_iterator& other) const { return !(operator==(other)); }
+
+// ==========================================
+// EntryTable
+// ==========================================
+
+StrRef EntryTable::addString(std::string_view str) {
+	StrRef ref = { (uint32_t)arena.size(), (uint32_t)str.size() };
+	arena.append(str);
+	return ref;
+}
+
+size_t EntryTable::findBucket(std::string_view id) const {
+	size_t mask = idIndex.size() - 1;
+	for (size_t bucket = std::hash<std::string_view>{}(id) & mask;; bucket = (bucket + 1) & mask)
+		if (idIndex[bucket] == EMPTY_BUCKET || resolve(arena, ids[idIndex[bucket]]) == id) return bucket;
+}
+
+void EntryTable::rebuildIndex(size_t buckets) {
+	idIndex.assign(buckets, EMPTY_BUCKET);
+	for (uint32_t slot : order) idIndex[findBucket(resolve(arena, ids[slot]))] = slot;
+}
+
+void EntryTable::compact() {
+	size_t liveBytes = 0;
+	for (uint32_t slot : order)
+		for (const auto* field : { &ids, &paths, &names, &execs, &icons, &keywords }) liveBytes += (*field)[slot].length;
+	std::string compacted;
+	compacted.reserve(liveBytes);
+	auto move = [&](std::vector<StrRef>& field) {
+		std::vector<StrRef> kept;
+		kept.reserve(order.size());
+		for (uint32_t slot : order) {
+			kept.push_back({ (uint32_t)compacted.size(), field[slot].length });
+			compacted += resolve(arena, field[slot]);
+		}
+		field = std::move(kept);
+	};
+	for (auto* field : { &ids, &paths, &names, &execs, &icons, &keywords }) move(*field);
+	std::vector<uint8_t> keptTerminal;
+	keptTerminal.reserve(order.size());
+	for (uint32_t slot : order) keptTerminal.push_back(terminal[slot]);
+	terminal = std::move(keptTerminal);
+
+	arena = std::move(compacted);
+	// The entries are stored in name order now
+	for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+	rebuildIndex(idIndex.size());
+}
+
+bool EntryTable::nameLess(uint32_t a, uint32_t b) const {
+	return resolve(arena, names[a]) < resolve(arena, names[b]);
+}
+
+void EntryTable::clear() {
+	arena.clear();
+	for (auto* field : { &ids, &paths, &names, &execs, &icons, &keywords }) field->clear();
+	terminal.clear();
+	idIndex.clear();
+	order.clear();
+}
+
+void EntryTable::reserve(size_t entries, size_t stringBytes) {
+	arena.reserve(arena.size() + stringBytes);
+	for (auto* field : { &ids, &paths, &names, &execs, &icons, &keywords }) field->reserve(field->size() + entries);
+	terminal.reserve(terminal.size() + entries);
+	order.reserve(order.size() + entries);
+	size_t buckets = 16;
+	while (buckets < (order.size() + entries) * 2) buckets *= 2;
+	if (buckets > idIndex.size()) rebuildIndex(buckets);
+}
+
+bool EntryTable::add(std::string_view id, std::string_view path, std::string_view name, std::string_view exec, std::string_view icon,
+		std::string_view keywords, bool needsTerminal) {
+	if ((order.size() + 1) * 2 > idIndex.size()) rebuildIndex(std::max<size_t>(16, idIndex.size() * 2));
+	size_t bucket = findBucket(id);
+	if (idIndex[bucket] != EMPTY_BUCKET) return false;
+	size_t needed = id.size() + path.size() + name.size() + exec.size() + icon.size() + keywords.size();
+	if (arena.size() + needed > arena.capacity()) arena.reserve(std::max(arena.capacity() * 2, arena.size() + needed));
+
+	uint32_t slot = ids.size();
+	ids.push_back(addString(id));
+	paths.push_back(addString(path));
+	names.push_back(addString(name));
+	execs.push_back(addString(exec));
+	icons.push_back(addString(icon));
+	this->keywords.push_back(addString(keywords));
+	terminal.push_back(needsTerminal);
+	idIndex[bucket] = slot;
+	order.push_back(slot);
+	return true;
+}
+
+void EntryTable::insertSorted(std::string_view id, std::string_view path, std::string_view name, std::string_view exec, std::string_view icon,
+		std::string_view keywords, bool needsTerminal) {
+	if (!add(id, path, name, exec, icon, keywords, needsTerminal)) return;
+	uint32_t slot = order.back();
+	order.pop_back();
+	auto position = std::upper_bound(::begin(order), ::end(order), slot, [this](uint32_t a, uint32_t b) { return nameLess(a, b); });
+	order.insert(position, slot);
+}
+
+bool EntryTable::remove(std::string_view id) {
+	if (idIndex.empty()) return false;
+	size_t bucket = findBucket(id);
+	uint32_t slot = idIndex[bucket];
+	if (slot == EMPTY_BUCKET) return false;
+	order.erase(std::find(::begin(order), ::end(order), slot));
+
+	// Backward shift deletion: the entries after the bucket that can't be reached past an empty bucket move into it
+	size_t mask = idIndex.size() - 1;
+	for (size_t next = (bucket + 1) & mask; idIndex[next] != EMPTY_BUCKET; next = (next + 1) & mask) {
+		size_t home = std::hash<std::string_view>{}(resolve(arena, ids[idIndex[next]])) & mask;
+		// The entry stays if its home lies cyclically in (bucket, next]
+		if (((next - home) & mask) < ((next - bucket) & mask)) continue;
+		idIndex[bucket] = idIndex[next];
+		bucket = next;
+	}
+	idIndex[bucket] = EMPTY_BUCKET;
+
+	if (ids.size() - order.size() > order.size()) compact();
+	return true;
+}
+
+void EntryTable::sort() {
+	std::stable_sort(::begin(order), ::end(order), [this](uint32_t a, uint32_t b) { return nameLess(a, b); });
+}
+
+EntryTable::const_iterator EntryTable::begin() const { return { this, order.begin() }; }
+EntryTable::const_iterator EntryTable::end() const { return { this, order.end() }; }
+size_t EntryTable::size() const { return order.size(); }
+DesktopEntryView EntryTable::operator[](size_t i) const { return { this, order[i] }; }
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <iterator>
+#include "cacheFile.hpp"
+#include "utils.hpp"
+
+class EntryTable;
+
+// A view of an entry of an EntryTable, valid until the table changes
+class DesktopEntryView {
+	const EntryTable* table;
+	uint32_t slot;
+public:
+	DesktopEntryView(const EntryTable* table, uint32_t slot);
+
+	std::string_view getId() const;
+	std::string_view getPath() const;
+	std::string_view getName() const;
+	std::string_view getExec() const;
+	std::string_view getIconId() const;
+	// The raw Keywords value, a list separated by ';'
+	std::string_view getKeywords() const;
+	bool needsTerminal() const;
+};
+
+// The desktop entries in struct-of-arrays form. The strings of every entry live in one arena and the fields
+// are offset/length pairs into it, so a table of thousands of entries takes a handful of allocations.
+// Entries are deduplicated by id through a hash index and iterated in name order.
+class EntryTable {
+	friend class DesktopEntryView;
+
+	std::string arena;
+	std::vector<StrRef> ids, paths, names, execs, icons, keywords;
+	std::vector<uint8_t> terminal;
+	// Open addressing with linear probing over the slots, EMPTY_BUCKET marks a free bucket. The size is a power
+	// of two at least twice the number of entries, the ids are compared through the arena so it never moves keys.
+	std::vector<uint32_t> idIndex;
+	// The slots of the entries sorted by name. Removed entries keep their slot and their strings
+	// until they outnumber the live ones, then the table is compacted.
+	std::vector<uint32_t> order;
+
+	static constexpr uint32_t EMPTY_BUCKET = ~0u;
+
+	StrRef addString(std::string_view str);
+	// The bucket holding id, or the empty bucket where it would go
+	size_t findBucket(std::string_view id) const;
+	void rebuildIndex(size_t buckets);
+	// Drops the strings and slots of the removed entries
+	void compact();
+	bool nameLess(uint32_t a, uint32_t b) const;
+public:
+	class const_iterator {
+		const EntryTable* table;
+		std::vector<uint32_t>::const_iterator position;
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = DesktopEntryView;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = DesktopEntryView;
+
+		const_iterator(const EntryTable* table, std::vector<uint32_t>::const_iterator position);
+		DesktopEntryView operator*() const;
+		const_iterator& operator++();
+		bool operator==(const const_iterator& other) const;
+		bool operator!=(const const_iterator& other) const;
+	};
+
+	void clear();
+	// Reserves room for entries entries whose strings add up to stringBytes
+	void reserve(size_t entries, size_t stringBytes);
+	// Adds an entry at the end of the order, unless an entry with the same id exists. Returns whether it was added.
+	bool add(std::string_view id, std::string_view path, std::string_view name, std::string_view exec, std::string_view icon,
+			std::string_view keywords, bool needsTerminal);
+	// Adds an entry keeping the name order, the entry must not exist yet
+	void insertSorted(std::string_view id, std::string_view path, std::string_view name, std::string_view exec, std::string_view icon,
+			std::string_view keywords, bool needsTerminal);
+	bool remove(std::string_view id);
+	// Sorts the entries by name, entries with the same name keep their order
+	void sort();
+
+	const_iterator begin() const;
+	const_iterator end() const;
+	size_t size() const;
+	// The i-th entry in name order
+	DesktopEntryView operator[](size_t i) const;
+};
@@ -0,0 +1,43 @@
+#include "escape.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "utils.hpp"
+
+namespace {
+bool needsEscape(uint8_t b) { return b == '\n' || b == '\\' || b == '\0'; }
+char escapeCode(uint8_t b) { return b == '\n' ? 'n' : b == '\0' ? '0' : '\\'; }
+}
+
+size_t findEscapedByte(const uint8_t* data, size_t size) {
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= size; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, newline), _mm_cmpeq_epi8(bytes, backslash)),
+				_mm_cmpeq_epi8(bytes, zero));
+		int mask = _mm_movemask_epi8(matches);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+#endif
+	for (; i < size; i++)
+		if (needsEscape(data[i])) return i;
+	return size;
+}
+
+void appendEscaped(std::string& out, const uint8_t* data, size_t size) {
+	while (size > 0) {
+		size_t run = findEscapedByte(data, size);
+		out.append((const char*)data, run);
+		if (run == size) return;
+		const char escaped[2] = { '\\', escapeCode(data[run]) };
+		out.append(escaped, 2);
+		data += run + 1;
+		size -= run + 1;
+	}
+}
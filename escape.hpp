@@ -0,0 +1,11 @@
+#pragma once
+
+#include "utils.hpp"
+
+// dmenu reads the icon data in its line, so '\n', '\\' and '\0' are escaped as "\n", "\\" and "\0".
+// The bytes that need escaping are found 16 at a time with SSE2, the runs between them are copied whole.
+
+// Returns the index of the first byte that needs escaping, or size if there is none
+size_t findEscapedByte(const uint8_t* data, size_t size);
+// Appends the escaped data, out only allocates if its capacity is exceeded
+void appendEscaped(std::string& out, const uint8_t* data, size_t size);
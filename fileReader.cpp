@@ -0,0 +1,279 @@
+#include "fileReader.hpp"
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+namespace {
+// ==========================================
+// ReadFileReader
+// ==========================================
+
+class ReadFileReader : public FileReader {
+public:
+	Backend getBackend() const override { return Backend::READ; }
+	void readFiles(const std::vector<FileRequest>& files, const Callback& done) override {
+		for (size_t i = 0; i < files.size(); i++) {
+			int fd = openat(files[i].dirFd, files[i].path.data(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0) continue;
+			Stats::add(Stats::FILES_OPENED);
+			struct stat st;
+			std::unique_ptr<char[]> data;
+			size_t size = 0;
+			if (fstat(fd, &st) == 0 && st.st_size > 0) {
+				data = std::make_unique<char[]>(st.st_size);
+				while (size < (size_t)st.st_size) {
+					ssize_t readCount = read(fd, data.get() + size, st.st_size - size);
+					if (readCount <= 0) break;
+					size += readCount;
+				}
+			}
+			close(fd);
+			Stats::add(Stats::BYTES_READ, size);
+			if (size > 0) done(i, std::move(data), size);
+		}
+	}
+};
+
+// ==========================================
+// UringFileReader
+// ==========================================
+
+constexpr unsigned RING_ENTRIES = 256;
+// Every file takes two submissions in each phase
+constexpr size_t BATCH_FILES = RING_ENTRIES / 2;
+
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+	return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned args) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, args);
+}
+
+// A batch of files is read in two phases: the files are opened and stated together, then every opened
+// file is read into a buffer of its size and closed. The close is hard linked to the read so it runs
+// even if the read fails. The files are passed to the callback once the batch is complete.
+class UringFileReader : public FileReader {
+	int ringFd = -1;
+	void* sqRing = MAP_FAILED;
+	void* cqRing = MAP_FAILED;
+	size_t sqRingSize = 0, cqRingSize = 0;
+	io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+	size_t sqesSize = 0;
+
+	unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	io_uring_cqe* cqes;
+	// Submissions queued since the last submit
+	unsigned queued = 0;
+	// Set when the ring failed while the kernel still held submissions, it can't be used anymore
+	bool broken = false;
+
+	struct File {
+		int fd = -1;
+		bool stated = false;
+		struct statx st;
+		std::unique_ptr<char[]> data;
+		size_t size = 0;
+	};
+
+	template<typename T> T* at(void* ring, uint32_t offset) { return (T*)((char*)ring + offset); }
+
+	io_uring_sqe* nextSqe(uint8_t opcode, int fd, uint64_t userData) {
+		unsigned tail = *sqTail;
+		unsigned index = tail & *sqMask;
+		io_uring_sqe* sqe = &sqes[index];
+		memset(sqe, 0, sizeof *sqe);
+		sqe->opcode = opcode;
+		sqe->fd = fd;
+		sqe->user_data = userData;
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		queued++;
+		return sqe;
+	}
+
+	// Submits the queued submissions and calls handle for each of their completions, handle must not throw.
+	// The submissions point into the batch, so when submitting fails the ones the kernel took are still
+	// waited for before throwing. If waiting fails too the reader is broken.
+	template<typename Handler> void submitAndWait(Handler&& handle) {
+		unsigned pending = queued;
+		unsigned toSubmit = queued;
+		queued = 0;
+		std::string error;
+		while (pending > 0) {
+			int ret = ioUringEnter(ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+			if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				error = "io_uring_enter failed: "s + strerror(errno);
+				if (toSubmit == 0) {
+					broken = true;
+					break;
+				}
+				// The submissions the kernel didn't take are dropped
+				__atomic_store_n(sqTail, __atomic_load_n(sqHead, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+				pending -= toSubmit;
+				toSubmit = 0;
+				continue;
+			}
+			if (ret > 0) toSubmit -= std::min<unsigned>(ret, toSubmit);
+
+			unsigned head = *cqHead;
+			unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+			for (; head != tail; head++, pending--) {
+				const io_uring_cqe& cqe = cqes[head & *cqMask];
+				handle(cqe.user_data, cqe.res);
+			}
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+		}
+		if (!error.empty()) throw std::runtime_error(error);
+	}
+
+	void readBatch(const std::vector<FileRequest>& files, size_t first, size_t count, const Callback& done) {
+		auto batch = std::make_unique<File[]>(count);
+		// On failure the files left open are closed. A broken ring may still write into the batch, so it's leaked.
+		auto runPhase = [&](auto&& handle) {
+			try {
+				submitAndWait(handle);
+			} catch (...) {
+				if (broken) {
+					batch.release();
+					throw;
+				}
+				for (size_t i = 0; i < count; i++)
+					if (batch[i].fd >= 0) close(batch[i].fd);
+				throw;
+			}
+		};
+
+		for (size_t i = 0; i < count; i++) {
+			const auto& request = files[first + i];
+			auto* open = nextSqe(IORING_OP_OPENAT, request.dirFd, i * 2);
+			open->addr = (uint64_t)request.path.data();
+			open->open_flags = O_RDONLY | O_CLOEXEC;
+			auto* stat = nextSqe(IORING_OP_STATX, request.dirFd, i * 2 + 1);
+			stat->addr = (uint64_t)request.path.data();
+			stat->len = STATX_SIZE;
+			stat->off = (uint64_t)&batch[i].st;
+		}
+		runPhase([&batch](uint64_t userData, int res) {
+			if (res < 0) return;
+			if (userData % 2 == 0) {
+				batch[userData / 2].fd = res;
+				Stats::add(Stats::FILES_OPENED);
+			} else {
+				batch[userData / 2].stated = true;
+			}
+		});
+
+		for (size_t i = 0; i < count; i++) {
+			auto& file = batch[i];
+			if (file.fd < 0) continue;
+			if (file.stated && file.st.stx_size > 0) {
+				file.data = std::make_unique<char[]>(file.st.stx_size);
+				auto* read = nextSqe(IORING_OP_READ, file.fd, i * 2);
+				read->addr = (uint64_t)file.data.get();
+				read->len = file.st.stx_size;
+				read->flags = IOSQE_IO_HARDLINK;
+			}
+			nextSqe(IORING_OP_CLOSE, file.fd, i * 2 + 1);
+		}
+		runPhase([&batch](uint64_t userData, int res) {
+			auto& file = batch[userData / 2];
+			// Even a failed close releases the descriptor
+			if (userData % 2 == 1) file.fd = -1;
+			else if (res > 0) file.size = res;
+		});
+
+		for (size_t i = 0; i < count; i++) {
+			if (batch[i].size == 0) continue;
+			Stats::add(Stats::BYTES_READ, batch[i].size);
+			done(first + i, std::move(batch[i].data), batch[i].size);
+		}
+	}
+public:
+	bool init() {
+		io_uring_params params = {};
+		ringFd = ioUringSetup(RING_ENTRIES, &params);
+		if (ringFd < 0) return false;
+
+		// Opening, stating and closing through the ring need newer kernels than the ring itself
+		size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+		auto probeData = std::make_unique<char[]>(probeSize);
+		memset(probeData.get(), 0, probeSize);
+		auto* probe = (io_uring_probe*)probeData.get();
+		if (ioUringRegister(ringFd, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+		for (uint8_t op : { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE })
+			if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+		if (sqRing == MAP_FAILED) return false;
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			cqRing = sqRing;
+		} else {
+			cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+			if (cqRing == MAP_FAILED) return false;
+		}
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) return false;
+
+		sqHead = at<unsigned>(sqRing, params.sq_off.head);
+		sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+		sqMask = at<unsigned>(sqRing, params.sq_off.ring_mask);
+		sqArray = at<unsigned>(sqRing, params.sq_off.array);
+		cqHead = at<unsigned>(cqRing, params.cq_off.head);
+		cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+		cqMask = at<unsigned>(cqRing, params.cq_off.ring_mask);
+		cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+		return true;
+	}
+
+	~UringFileReader() {
+		if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+		if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+		if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+		if (ringFd >= 0) close(ringFd);
+	}
+
+	Backend getBackend() const override { return Backend::IO_URING; }
+	void readFiles(const std::vector<FileRequest>& files, const Callback& done) override {
+		TRACE_SCOPE("UringFileReader::readFiles");
+		if (broken) throw std::runtime_error("the io_uring reader failed earlier");
+		for (size_t first = 0; first < files.size(); first += BATCH_FILES)
+			readBatch(files, first, std::min(BATCH_FILES, files.size() - first), done);
+	}
+};
+}
+
+// ==========================================
+// FileReader
+// ==========================================
+
+std::unique_ptr<FileReader> FileReader::create(Backend backend) {
+	if (backend == Backend::IO_URING || (backend == Backend::AUTO && USE_IO_URING)) {
+		auto reader = std::make_unique<UringFileReader>();
+		if (reader->init()) return reader;
+	}
+	if (backend == Backend::IO_URING) return nullptr;
+	return std::make_unique<ReadFileReader>();
+}
+
+FileReader& FileReader::local() {
+	thread_local std::unique_ptr<FileReader> reader = create();
+	return *reader;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include "utils.hpp"
+
+// Reads many small files whole, like the .desktop files and the index.theme files.
+// The io_uring backend submits the opens, stats, reads and closes of a batch of files together,
+// through raw syscalls so that no library is needed. The read backend opens and reads the files one by one,
+// it's used when the kernel has no io_uring or doesn't support the operations.
+
+struct FileRequest {
+	// The path is relative to dirFd unless it's absolute, it must be NUL terminated
+	int dirFd;
+	std::string_view path;
+};
+
+class FileReader {
+public:
+	enum class Backend { AUTO, IO_URING, READ };
+	// Called with the index of the request and the content of the file, for every file that could be read
+	using Callback = std::function<void(size_t index, std::unique_ptr<char[]> data, size_t size)>;
+
+	virtual ~FileReader() = default;
+	// Reads the files, done is called on the calling thread in the order of the requests
+	virtual void readFiles(const std::vector<FileRequest>& files, const Callback& done) = 0;
+	// Never AUTO. With READ, reading the files on several threads is faster than one batch.
+	virtual Backend getBackend() const = 0;
+
+	// Returns nullptr if the backend is not available, AUTO uses io_uring if USE_IO_URING is set and falls back to READ
+	static std::unique_ptr<FileReader> create(Backend backend = Backend::AUTO);
+	// A reader owned by the calling thread, created on first use
+	static FileReader& local();
+};
@@ -0,0 +1,133 @@
+#include "fsWatcher.hpp"
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "utils.hpp"
+
+namespace {
+constexpr uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO
+	| IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+// Added to the mask of an ancestor, which may also be a directory of a tree
+constexpr uint32_t ANCESTOR_MASK = IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD;
+
+bool isWithin(const fs::path& path, const fs::path& dir) {
+	return std::mismatch(begin(dir), end(dir), begin(path), end(path)).first == end(dir);
+}
+}
+
+FsWatcher::FsWatcher() : fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {
+	if (fd < 0) throw std::runtime_error("cannot initialize inotify");
+}
+FsWatcher::FsWatcher(const std::vector<fs::path>& roots) : FsWatcher() {
+	for (const auto& root : roots) watchTree(root);
+}
+FsWatcher::~FsWatcher() { close(fd); }
+
+int FsWatcher::getFd() const { return fd; }
+
+void FsWatcher::watchTree(const fs::path& root) {
+	roots.push_back(root);
+	std::error_code ec;
+	if (fs::is_directory(root, ec)) return addTree(root);
+	missingRoots.push_back(root);
+	std::vector<Event> events;
+	watchMissingRoots(events);
+}
+
+void FsWatcher::addTree(const fs::path& dir) {
+	int wd = inotify_add_watch(fd, dir.c_str(), WATCH_MASK);
+	if (wd < 0) return;
+	watches[wd] = dir;
+	std::error_code ec;
+	for (const auto& file : fs::recursive_directory_iterator(dir, ec)) {
+		if (!file.is_directory(ec)) continue;
+		wd = inotify_add_watch(fd, file.path().c_str(), WATCH_MASK);
+		if (wd >= 0) watches[wd] = file.path();
+	}
+}
+
+void FsWatcher::removeTree(const fs::path& dir) {
+	for (auto watch = begin(watches); watch != end(watches);) {
+		if (!isWithin(watch->second, dir)) {
+			++watch;
+			continue;
+		}
+		// Fails if the directory is already gone, the kernel removed the watch then
+		inotify_rm_watch(fd, watch->first);
+		watch = watches.erase(watch);
+	}
+}
+
+void FsWatcher::watchMissingRoots(std::vector<Event>& events) {
+	std::unordered_map<int, fs::path> watchedAncestors;
+	std::vector<fs::path> stillMissing;
+	for (const auto& root : missingRoots) {
+		std::error_code ec;
+		if (fs::is_directory(root, ec)) {
+			addTree(root);
+			events.push_back({ root, true });
+			continue;
+		}
+		fs::path ancestor = root.parent_path();
+		while (!fs::is_directory(ancestor, ec) && ancestor.has_relative_path()) ancestor = ancestor.parent_path();
+		int wd = inotify_add_watch(fd, ancestor.c_str(), ANCESTOR_MASK);
+		if (wd >= 0) watchedAncestors[wd] = ancestor;
+		stillMissing.push_back(root);
+	}
+	for (const auto& [ wd, ancestor ] : ancestors)
+		if (!watchedAncestors.count(wd) && !watches.count(wd)) inotify_rm_watch(fd, wd);
+	ancestors = std::move(watchedAncestors);
+	missingRoots = std::move(stillMissing);
+}
+
+bool FsWatcher::readEvents(std::vector<Event>& events) {
+	alignas(inotify_event) char buffer[16 * 1024];
+	bool complete = true;
+	bool rootsChanged = false;
+	for (;;) {
+		ssize_t readCount = read(fd, buffer, sizeof buffer);
+		if (readCount < 0 && errno == EINTR) continue;
+		if (readCount <= 0) break;
+		for (char* pos = buffer; pos < buffer + readCount;) {
+			const auto* event = (const inotify_event*)pos;
+			pos += sizeof(inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				complete = false;
+				continue;
+			}
+			if (event->mask & IN_IGNORED) {
+				watches.erase(event->wd);
+				ancestors.erase(event->wd);
+				continue;
+			}
+			// Something was created on the way to a missing root
+			if (ancestors.count(event->wd)) rootsChanged = true;
+			auto dir = watches.find(event->wd);
+			if (dir == end(watches)) continue;
+
+			// Other directories are handled with the event on their parent
+			if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				if (std::find(begin(roots), end(roots), dir->second) == end(roots)) continue;
+				fs::path root = dir->second;
+				removeTree(root);
+				missingRoots.push_back(root);
+				rootsChanged = true;
+				events.push_back({ std::move(root), true });
+				continue;
+			}
+			if (event->len == 0) continue;
+
+			fs::path path = dir->second / event->name;
+			bool isDirectory = event->mask & IN_ISDIR;
+			if (isDirectory && (event->mask & (IN_CREATE | IN_MOVED_TO))) addTree(path);
+			if (isDirectory && (event->mask & (IN_DELETE | IN_MOVED_FROM))) removeTree(path);
+			events.push_back({ std::move(path), isDirectory });
+		}
+	}
+	if (rootsChanged) watchMissingRoots(events);
+	return complete;
+}
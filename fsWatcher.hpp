@@ -0,0 +1,39 @@
+#pragma once
+
+#include "utils.hpp"
+
+// Recursive inotify watcher, directories created inside a watched tree are watched automatically.
+// A root that doesn't exist is watched through its closest existing ancestor until it's created,
+// a root that is deleted or moved away is waited for the same way. A root appearing or disappearing
+// is reported as a directory event on the root.
+class FsWatcher {
+public:
+	struct Event {
+		fs::path path;
+		bool isDirectory;
+	};
+private:
+	int fd;
+	// The directories of the trees by watch descriptor
+	std::unordered_map<int, fs::path> watches;
+	std::vector<fs::path> roots;
+	// The roots that don't exist, and the ancestors watched for their creation by watch descriptor
+	std::vector<fs::path> missingRoots;
+	std::unordered_map<int, fs::path> ancestors;
+
+	void addTree(const fs::path& dir);
+	// Stops watching dir and the directories below it
+	void removeTree(const fs::path& dir);
+	// Watches the missing roots that exist now and reports them, then watches the ancestors of the others
+	void watchMissingRoots(std::vector<Event>& events);
+public:
+	FsWatcher();
+	explicit FsWatcher(const std::vector<fs::path>& roots);
+	FsWatcher(const FsWatcher&) = delete;
+	~FsWatcher();
+
+	int getFd() const;
+	void watchTree(const fs::path& root);
+	// Appends the pending events without blocking, returns false if the kernel queue overflowed and events were lost
+	bool readEvents(std::vector<Event>& events);
+};
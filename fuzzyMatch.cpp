@@ -0,0 +1,146 @@
+#include "fuzzyMatch.hpp"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "trace.hpp"
+#include "utils.hpp"
+
+namespace {
+constexpr int32_t NO_MATCH = std::numeric_limits<int32_t>::min();
+constexpr int32_t MATCH = 16;
+constexpr int32_t PREFIX = 12;
+constexpr int32_t WORD_START = 8;
+constexpr int32_t CONSECUTIVE = 6;
+constexpr int32_t GAP_START = 3;
+constexpr int32_t GAP = 1;
+constexpr int32_t EXACT = 32;
+// The id and the keywords only rank above the name of another entry when they match clearly better
+constexpr int32_t FIELD_PENALTY = 10;
+
+char lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+bool isSeparator(char c) { return c == ' ' || c == '-' || c == '_' || c == '.' || c == '/' || c == ';'; }
+
+// Letters and digits get a bit each, the other bytes share the remaining bits
+uint64_t byteBit(uint8_t c) {
+	if (c >= 'a' && c <= 'z') return 1ull << (c - 'a');
+	if (c >= '0' && c <= '9') return 1ull << (26 + c - '0');
+	return 1ull << (36 + c % 28);
+}
+uint64_t byteMask(std::string_view text) {
+	uint64_t mask = 0;
+	for (char c : text) mask |= byteBit(c);
+	return mask;
+}
+
+int32_t scoreField(std::string_view text, std::string_view query) {
+	size_t end = findSubsequence(text, query);
+	if (end == std::string_view::npos) return NO_MATCH;
+	// The leftmost match can start early and leave gaps, walking back from its end finds the shortest window
+	size_t start = end;
+	for (size_t j = query.size(); j > 0;)
+		if (text[--start] == query[j - 1]) j--;
+
+	int32_t score = text.size() == query.size() ? EXACT : 0;
+	size_t last = std::string_view::npos;
+	for (size_t i = start, j = 0; i < end; i++) {
+		if (text[i] != query[j]) continue;
+		score += MATCH;
+		if (i == 0) score += PREFIX;
+		else if (isSeparator(text[i - 1])) score += WORD_START;
+		if (last != std::string_view::npos) {
+			if (i == last + 1) score += CONSECUTIVE;
+			else score -= GAP_START + (i - last - 2) * GAP;
+		}
+		last = i;
+		j++;
+	}
+	return score;
+}
+}
+
+size_t findSubsequence(std::string_view text, std::string_view query) {
+	if (query.empty()) return 0;
+	const char* data = text.data();
+	size_t size = text.size();
+	size_t i = 0, j = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= size; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+		// Several query characters can match in one block, each one only after the previous match
+		unsigned consumed = 0;
+		for (;;) {
+			unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(query[j]))) & (0xffffu << consumed);
+			if (!mask) break;
+			unsigned position = __builtin_ctz(mask);
+			if (++j == query.size()) return i + position + 1;
+			consumed = position + 1;
+		}
+	}
+#endif
+	for (; i < size; i++)
+		if (data[i] == query[j] && ++j == query.size()) return i + 1;
+	return std::string_view::npos;
+}
+
+// ==========================================
+// FuzzyMatcher
+// ==========================================
+
+FuzzyMatcher::FuzzyMatcher(const DesktopEntries& entries) {
+	TRACE_SCOPE("FuzzyMatcher");
+	size_t bytes = 0;
+	for (auto entry : entries) bytes += entry.getName().size() + entry.getId().size() + entry.getKeywords().size();
+	text.reserve(bytes);
+	fields.reserve(entries.size());
+	masks.reserve(entries.size());
+	for (auto entry : entries) {
+		auto& refs = fields.emplace_back();
+		std::string_view values[FIELD_COUNT] = { entry.getName(), entry.getId(), entry.getKeywords() };
+		for (int field = 0; field < FIELD_COUNT; field++) {
+			refs[field] = { (uint32_t)text.size(), (uint32_t)values[field].size() };
+			for (char c : values[field]) text += lower(c);
+		}
+		masks.push_back(byteMask(std::string_view(text).substr(refs[NAME].offset)));
+	}
+}
+
+int32_t FuzzyMatcher::score(uint32_t index, uint64_t queryMask) const {
+	if (queryMask & ~masks[index]) return NO_MATCH;
+	int32_t best = NO_MATCH;
+	for (int field = 0; field < FIELD_COUNT; field++) {
+		int32_t score = scoreField(resolve(text, fields[index][field]), query);
+		if (score == NO_MATCH) continue;
+		best = std::max(best, field == NAME ? score : score - FIELD_PENALTY);
+	}
+	return best;
+}
+
+std::vector<uint32_t> FuzzyMatcher::filter(std::string_view newQuery, size_t limit) {
+	TRACE_SCOPE("FuzzyMatcher::filter", newQuery);
+	std::string lowered;
+	for (char c : newQuery) lowered += lower(c);
+	// Every entry matching the extended query matched the previous one, so only those are checked again
+	bool extends = !candidates.empty() && lowered.compare(0, query.size(), query) == 0;
+	query = std::move(lowered);
+	if (!extends) {
+		candidates.resize(fields.size());
+		for (uint32_t i = 0; i < fields.size(); i++) candidates[i] = i;
+	}
+
+	uint64_t queryMask = byteMask(query);
+	std::vector<Match> matches;
+	for (uint32_t index : candidates) {
+		int32_t score = this->score(index, queryMask);
+		if (score != NO_MATCH) matches.push_back({ index, score });
+	}
+	candidates.clear();
+	for (const auto& match : matches) candidates.push_back(match.index);
+
+	std::stable_sort(::begin(matches), ::end(matches), [](const Match& a, const Match& b) { return a.score > b.score; });
+	std::vector<uint32_t> out;
+	for (size_t i = 0; i < matches.size() && i < limit; i++) out.push_back(matches[i].index);
+	return out;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <limits>
+#include "cacheFile.hpp"
+#include "desktopEntries.hpp"
+#include "utils.hpp"
+
+// Fuzzy matching of a query against the names, ids and keywords of the entries, ignoring ASCII case.
+// An entry matches if the query is a subsequence of one of its fields. Entries are prefiltered with a
+// bitmask of the bytes they contain, then the fields are scanned 16 bytes at a time with SSE2.
+// The matches are ranked by score: word starts, prefixes and consecutive characters score higher,
+// gaps lower, and the name counts more than the id and the keywords.
+
+// Returns the index past the last character of the leftmost match of query in text, or npos
+size_t findSubsequence(std::string_view text, std::string_view query);
+
+class FuzzyMatcher {
+	enum Field { NAME, ID, KEYWORDS, FIELD_COUNT };
+	struct Match {
+		uint32_t index;
+		int32_t score;
+	};
+
+	// The lowercased fields of every entry, in entry order
+	std::string text;
+	std::vector<std::array<StrRef, FIELD_COUNT>> fields;
+	std::vector<uint64_t> masks;
+	// The last query and the entries it matched, an extended query only checks those
+	std::string query;
+	std::vector<uint32_t> candidates;
+
+	int32_t score(uint32_t index, uint64_t queryMask) const;
+public:
+	FuzzyMatcher(const DesktopEntries& entries);
+
+	// Returns the indexes of the entries matching query, best first, entries with the same score in entry order
+	std::vector<uint32_t> filter(std::string_view query, size_t limit = std::numeric_limits<size_t>::max());
+};
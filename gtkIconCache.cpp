@@ -0,0 +1,84 @@
+#include "gtkIconCache.hpp"
+#include <cstring>
+
+#include "cacheFile.hpp"
+#include "utils.hpp"
+
+namespace {
+constexpr uint32_t NONE = 0xffffffff;
+
+// Same hash used by gtk, note that the characters are signed
+uint32_t iconNameHash(std::string_view name) {
+	if (name.empty()) return 0;
+	uint32_t h = (signed char)name[0];
+	for (size_t i = 1; i < name.size(); i++) h = (h << 5) - h + (signed char)name[i];
+	return h;
+}
+}
+
+uint16_t GtkIconCache::read16(uint32_t offset) const {
+	const uint8_t* p = file.at<uint8_t>(offset, 2);
+	return p ? (p[0] << 8) | p[1] : 0;
+}
+uint32_t GtkIconCache::read32(uint32_t offset) const {
+	const uint8_t* p = file.at<uint8_t>(offset, 4);
+	return p ? ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] : NONE;
+}
+std::string_view GtkIconCache::readString(uint32_t offset) const {
+	if (offset >= file.getSize()) return {};
+	const char* str = file.getData() + offset;
+	const void* nul = memchr(str, '\0', file.getSize() - offset);
+	return nul ? std::string_view(str, (const char*)nul - str) : std::string_view();
+}
+
+GtkIconCache::GtkIconCache(const fs::path& themeDir) {
+	int64_t themeMtime = getMtime(themeDir);
+	if (themeMtime < 0) return;
+	MappedFile cache(themeDir / "icon-theme.cache");
+	if (!cache.isOpen() || cache.getMtime() < themeMtime) return;
+	file = std::move(cache);
+
+	if (read16(0) != 1) {
+		file = MappedFile();
+		return;
+	}
+	hashOffset = read32(4);
+	dirListOffset = read32(8);
+	if (hashOffset == NONE || dirListOffset == NONE) file = MappedFile();
+}
+
+bool GtkIconCache::isValid() const { return file.isOpen(); }
+
+std::vector<std::string_view> GtkIconCache::getDirectories() const {
+	std::vector<std::string_view> dirs;
+	uint32_t count = read32(dirListOffset);
+	if (count == NONE) return dirs;
+	dirs.reserve(count);
+	for (uint32_t i = 0; i < count; i++)
+		dirs.push_back(readString(read32(dirListOffset + 4 + i * 4)));
+	return dirs;
+}
+
+std::vector<GtkIconCache::Image> GtkIconCache::lookup(std::string_view name) const {
+	std::vector<Image> images;
+	uint32_t bucketCount = read32(hashOffset);
+	if (bucketCount == 0 || bucketCount == NONE) return images;
+
+	uint32_t iconOffset = read32(hashOffset + 4 + (iconNameHash(name) % bucketCount) * 4);
+	// The chain length is bounded to protect against loops in corrupted files
+	for (size_t steps = 0; iconOffset != NONE && steps < file.getSize() / 12; steps++) {
+		if (readString(read32(iconOffset + 4)) == name) {
+			uint32_t listOffset = read32(iconOffset + 8);
+			uint32_t imageCount = read32(listOffset);
+			if (imageCount > file.getSize() / 8) break;
+			images.reserve(imageCount);
+			for (uint32_t i = 0; i < imageCount; i++) {
+				uint32_t imageOffset = listOffset + 4 + i * 8;
+				images.push_back({ read16(imageOffset), read16(imageOffset + 2) });
+			}
+			break;
+		}
+		iconOffset = read32(iconOffset);
+	}
+	return images;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "cacheFile.hpp"
+#include "utils.hpp"
+
+// Reader for the icon-theme.cache files generated by gtk-update-icon-cache.
+// The file is a big endian hash table from icon names to the theme subdirectories containing them:
+// Header:    u16 major, u16 minor, u32 hashOffset, u32 directoryListOffset
+// Hash:      u32 bucketCount, u32 iconOffset[bucketCount]
+// Icon:      u32 chainOffset, u32 nameOffset, u32 imageListOffset
+// ImageList: u32 imageCount, { u16 directoryIndex, u16 flags, u32 imageDataOffset }[imageCount]
+// DirList:   u32 directoryCount, u32 nameOffset[directoryCount]
+class GtkIconCache {
+	MappedFile file;
+	uint32_t hashOffset = 0;
+	uint32_t dirListOffset = 0;
+
+	uint16_t read16(uint32_t offset) const;
+	uint32_t read32(uint32_t offset) const;
+	std::string_view readString(uint32_t offset) const;
+public:
+	enum ImageFlags : uint16_t {
+		HAS_SUFFIX_XPM = 1,
+		HAS_SUFFIX_SVG = 2,
+		HAS_SUFFIX_PNG = 4,
+		HAS_ICON_FILE = 8,
+	};
+	struct Image {
+		uint16_t directory;
+		uint16_t flags;
+	};
+
+	// Opens themeDir/icon-theme.cache, the cache is invalid if missing or older than themeDir
+	GtkIconCache(const fs::path& themeDir);
+
+	bool isValid() const;
+	std::vector<std::string_view> getDirectories() const;
+	std::vector<Image> lookup(std::string_view name) const;
+};
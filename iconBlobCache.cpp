@@ -0,0 +1,171 @@
+#include "iconBlobCache.hpp"
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+
+#include "cacheFile.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+// The index file is laid out as: IndexHeader | IndexRecord[count] | strings
+// The blob file is laid out as: BlobHeader | payloads
+
+namespace {
+constexpr char INDEX_MAGIC[8] = { 'D', 'D', 'M', 'I', 'D', 'X', '0', '1' };
+constexpr char BLOB_MAGIC[8] = { 'D', 'D', 'M', 'B', 'L', 'O', 'B', '1' };
+constexpr uint32_t VERSION = 1;
+
+struct IndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t generation;
+	uint32_t stringsSize;
+	uint32_t reserved;
+};
+struct IndexRecord {
+	StrRef path;
+	uint32_t size;
+	uint32_t length;
+	int64_t mtime;
+	uint64_t offset;
+};
+struct BlobHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t generation;
+};
+}
+
+// ==========================================
+// IconBlobCache::Key
+// ==========================================
+
+bool IconBlobCache::Key::operator==(const Key& other) const { return size == other.size && path == other.path; }
+size_t IconBlobCache::KeyHash::operator()(const Key& key) const {
+	return std::hash<std::string_view>{}(key.path) ^ key.size;
+}
+
+// ==========================================
+// IconBlobCache
+// ==========================================
+
+void IconBlobCache::load() {
+	TRACE_SCOPE("IconBlobCache::load");
+	index = MappedFile(indexPath);
+	blob = MappedFile(blobPath);
+	const IndexHeader* header = index.at<IndexHeader>(0);
+	const BlobHeader* blobHeader = blob.at<BlobHeader>(0);
+	if (!header || !blobHeader) return;
+	if (memcmp(header->magic, INDEX_MAGIC, sizeof INDEX_MAGIC) != 0 || header->version != VERSION) return;
+	if (memcmp(blobHeader->magic, BLOB_MAGIC, sizeof BLOB_MAGIC) != 0 || blobHeader->version != VERSION) return;
+	if (header->generation != blobHeader->generation) return;
+
+	const IndexRecord* records = index.at<IndexRecord>(sizeof(IndexHeader), header->count);
+	const char* stringData = index.at<char>(sizeof(IndexHeader) + header->count * sizeof(IndexRecord), header->stringsSize);
+	if (!records || !stringData) return;
+	std::string_view strings(stringData, header->stringsSize);
+
+	cached.reserve(header->count);
+	lookup.reserve(header->count);
+	for (uint32_t i = 0; i < header->count; i++) {
+		const auto& r = records[i];
+		const char* payload = blob.at<char>(sizeof(BlobHeader) + r.offset, r.length);
+		if (!payload) continue;
+		lookup.emplace(Key{ resolve(strings, r.path), r.size }, cached.size());
+		cached.push_back({ r.mtime, { payload, r.length } });
+	}
+}
+
+IconBlobCache::IconBlobCache() : IconBlobCache(getCacheDir()) {}
+IconBlobCache::IconBlobCache(fs::path cacheDir) : indexPath(cacheDir / "icons.index"), blobPath(cacheDir / "icons.blob") {
+	load();
+	used = std::make_unique<std::atomic<bool>[]>(cached.size());
+}
+
+std::string_view IconBlobCache::getPayload(const Icon& icon, uint32_t size) {
+	const auto& path = icon.getPath().native();
+	int64_t mtime = getMtime(path);
+	auto it = lookup.find({ path, size });
+	if (it != end(lookup) && cached[it->second].mtime == mtime) {
+		Stats::add(Stats::ICON_CACHE_HITS);
+		used[it->second].store(true, std::memory_order_relaxed);
+		return cached[it->second].payload;
+	}
+
+	{
+		std::lock_guard guard(freshLock);
+		auto freshIt = freshLookup.find({ path, size });
+		if (freshIt != end(freshLookup)) {
+			Stats::add(Stats::ICON_CACHE_HITS);
+			return freshIt->second->payload;
+		}
+	}
+	Stats::add(Stats::ICON_CACHE_MISSES);
+	// Most pixels need no escaping, so one allocation per rendered icon is usually enough
+	std::string payload;
+	payload.reserve((size_t)size * size * 4 + size * size / 2);
+	icon.renderDmenu(payload, size);
+	std::lock_guard guard(freshLock);
+	auto freshIt = freshLookup.find({ path, size });
+	if (freshIt != end(freshLookup)) return freshIt->second->payload;
+	const auto& f = fresh.emplace_back(Fresh{ path, size, mtime, std::move(payload) });
+	freshLookup.emplace(Key{ f.path, f.size }, &f);
+	return f.payload;
+}
+
+bool IconBlobCache::save() {
+	std::lock_guard guard(freshLock);
+	if (fresh.empty()) return true;
+	TRACE_SCOPE("IconBlobCache::save");
+
+	StringTable strings;
+	std::vector<IndexRecord> records;
+	std::vector<std::string_view> payloads;
+	uint64_t offset = 0;
+	auto addRecord = [&](std::string_view path, uint32_t size, int64_t mtime, std::string_view payload) {
+		records.push_back({ strings.add(path), size, (uint32_t)payload.size(), mtime, offset });
+		payloads.push_back(payload);
+		offset += payload.size();
+	};
+	// Every cached payload whose source is unchanged is kept, a run that renders part of the icons must not evict
+	// the others. The used ones were checked by getPayload, the replaced ones have a fresh payload.
+	for (const auto& [ key, i ] : lookup) {
+		if (freshLookup.count(key) != 0) continue;
+		if (!used[i].load(std::memory_order_relaxed) && getMtime(key.path) != cached[i].mtime) continue;
+		addRecord(key.path, key.size, cached[i].mtime, cached[i].payload);
+	}
+	for (const auto& f : fresh)
+		addRecord(f.path, f.size, f.mtime, f.payload);
+
+	uint64_t generation = std::chrono::system_clock::now().time_since_epoch().count() ^ ((uint64_t)getpid() << 32);
+
+	BlobHeader blobHeader = {};
+	memcpy(blobHeader.magic, BLOB_MAGIC, sizeof BLOB_MAGIC);
+	blobHeader.version = VERSION;
+	blobHeader.generation = generation;
+	payloads.insert(begin(payloads), asBytes(blobHeader));
+
+	IndexHeader header = {};
+	memcpy(header.magic, INDEX_MAGIC, sizeof INDEX_MAGIC);
+	header.version = VERSION;
+	header.count = records.size();
+	header.generation = generation;
+	header.stringsSize = strings.size();
+
+	// The blob is renamed first, a reader that still sees the old index will reject it by generation
+	if (!writeFileAtomic(blobPath, payloads) || !writeFileAtomic(indexPath, { asBytes(header), asBytes(records), strings.view() }))
+		return false;
+
+	// The fresh payloads are in the files now, a long lived cache serves them from the new mapping
+	// instead of writing them again on every save
+	lookup.clear();
+	cached.clear();
+	freshLookup.clear();
+	fresh.clear();
+	load();
+	used = std::make_unique<std::atomic<bool>[]>(cached.size());
+	return true;
+}
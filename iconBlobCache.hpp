@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include "cacheFile.hpp"
+#include "icons.hpp"
+#include "utils.hpp"
+
+// Persistent cache of the scaled and escaped icon payloads sent to dmenu.
+// The payloads are stored back to back in a blob file, an index file maps (source path, size) to
+// the source mtime and the payload position. Both files carry the same generation number, so an
+// index is never used together with a blob written by a different run.
+class IconBlobCache {
+	struct Key {
+		std::string_view path;
+		uint32_t size;
+
+		bool operator==(const Key& other) const;
+	};
+	struct KeyHash {
+		size_t operator()(const Key& key) const;
+	};
+	struct Cached {
+		int64_t mtime;
+		std::string_view payload;
+	};
+	struct Fresh {
+		std::string path;
+		uint32_t size;
+		int64_t mtime;
+		std::string payload;
+	};
+
+	fs::path indexPath, blobPath;
+	MappedFile index, blob;
+	std::unordered_map<Key, uint32_t, KeyHash> lookup;
+	std::vector<Cached> cached;
+	// Whether getPayload checked the source of a cached payload, the others are stated by save
+	std::unique_ptr<std::atomic<bool>[]> used;
+
+	std::mutex freshLock;
+	std::deque<Fresh> fresh;
+	std::unordered_map<Key, const Fresh*, KeyHash> freshLookup;
+
+	void load();
+public:
+	IconBlobCache();
+	IconBlobCache(fs::path cacheDir);
+
+	// The returned view stays valid until the next save
+	std::string_view getPayload(const Icon& icon, uint32_t size = 16);
+	// If payloads were rendered since the last save, rewrites the cache with them and the cached payloads whose
+	// source is unchanged, then maps the new files. Must not run concurrently with getPayload.
+	bool save();
+};
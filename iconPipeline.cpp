@@ -0,0 +1,43 @@
+#include "iconPipeline.hpp"
+
+#include "trace.hpp"
+#include "utils.hpp"
+
+namespace {
+// The icons of the first entries, about a screen of dmenu, are prepared before the workers start. That is
+// a few probes, the names after them are looked up in the theme indexes, which a worker builds meanwhile.
+constexpr size_t PREPARED_ENTRIES = 32;
+}
+
+IconPipeline::IconPipeline(const std::vector<DesktopEntryView>& entries, Icons& icons, IconBlobCache& iconCache, uint32_t size, unsigned threads) :
+	slots(entries.size()), pool(threads) {
+	std::vector<std::string_view> names;
+	for (size_t i = 0; i < entries.size() && i < PREPARED_ENTRIES; i++) names.push_back(entries[i].getIconId());
+	icons.prepare(names);
+	size_t i = 0;
+	for (auto entry : entries) {
+		pool.submit([this, entry, &icons, &iconCache, size, i] {
+			std::optional<std::string_view> payload;
+			try {
+				TRACE_SCOPE("icon", entry.getIconId());
+				auto icon = icons.queryIconClosestSize(entry.getIconId(), size);
+				if (icon) payload = iconCache.getPayload(*icon, size);
+			} catch (const std::exception&) {
+				// An unreadable icon only drops the icon, not the entry
+			}
+			{
+				std::lock_guard guard(lock);
+				slots[i].payload = payload;
+				slots[i].ready = true;
+			}
+			slotReady.notify_all();
+		});
+		i++;
+	}
+}
+
+std::optional<std::string_view> IconPipeline::get(size_t i) {
+	std::unique_lock guard(lock);
+	slotReady.wait(guard, [this, i] { return slots[i].ready; });
+	return slots[i].payload;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include "desktopEntries.hpp"
+#include "iconBlobCache.hpp"
+#include "icons.hpp"
+#include "threadPool.hpp"
+#include "utils.hpp"
+
+// Resolves and renders the icons of the entries on a thread pool, in entry order,
+// so that the consumer can write each entry as soon as its icon is ready.
+class IconPipeline {
+	struct Slot {
+		std::optional<std::string_view> payload;
+		bool ready = false;
+	};
+
+	std::vector<Slot> slots;
+	std::mutex lock;
+	std::condition_variable slotReady;
+	// Declared last so that the workers are joined before the slots are destroyed
+	ThreadPool pool;
+public:
+	IconPipeline(const std::vector<DesktopEntryView>& entries, Icons& icons, IconBlobCache& iconCache, uint32_t size = 16, unsigned threads = WORKER_THREADS);
+
+	// Blocks until the icon of the i-th entry is rendered, returns nullopt if the entry has no icon
+	std::optional<std::string_view> get(size_t i);
+};
@@ -1,11 +1,21 @@
 #include "icons.hpp"
 #include <algorithm>
+#include <charconv>
 #include <filesystem>
 #include <iterator>
 #include <optional>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fileReader.hpp"
 #include "iniParse.hpp"
 #include "pngReader.hpp"
+#include "resample.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 // https://specifications.freedesktop.org/icon-theme-spec/icon-theme-spec-latest.html
@@ -15,98 +25,324 @@
 // Icon
 // ==========================================
 
-std::string Icon::escapeData(const std::vector<uint8_t>& pixels) const {
-	std::string out;
-	out.reserve(pixels.size());
-	for (auto b : pixels)
-		switch (b) {
-		case '\n':
-			out += "\\n";
-			break;
-		case '\\':
-			out += "\\\\";
-			break;
-		case '\0':
-			out += "\\0";
-			break;
-		default:
-			out += b;
-		}
-	return out;
-}
 Icon::Icon(std::string_view name) : name(name) {}
 Icon::Icon(std::string_view name, uint32_t size, fs::path path) : name(name), size(size), path(path) {}
 std::string_view Icon::getName() const { return name; }
 uint32_t Icon::getSize() const { return size; }
 const fs::path& Icon::getPath() const { return path; }
-std::string Icon::dmenuString() const {
+std::string Icon::dmenuString(uint32_t size) const {
+	std::string out;
+	renderDmenu(out, size);
+	return out;
+}
+void Icon::renderDmenu(std::string& out, uint32_t size) const {
+	thread_local ResampleScratch scratch;
 	PngReader png(path);
-	return escapeData(png.getScaledPixels(16, 16));
+	png.renderScaled(size, size, scratch, out);
 }
 bool Icon::operator==(const Icon& other) const { return name == other.name; }
 bool Icon::operator!=(const Icon& other) const { return !operator==(other); }
 
+// ==========================================
+// IconTheme::RecordIndex
+// ==========================================
+
+std::string_view IconTheme::RecordIndex::getName(const IconRecord& record) const {
+	return std::string_view(names).substr(record.nameOffset, record.nameLength);
+}
+std::pair<std::vector<IconTheme::IconRecord>::iterator, std::vector<IconTheme::IconRecord>::iterator> IconTheme::RecordIndex::find(std::string_view name) {
+	auto first = std::lower_bound(begin(records), end(records), name, [this](const auto& r, std::string_view n) { return getName(r) < n; });
+	auto last = std::upper_bound(first, end(records), name, [this](std::string_view n, const auto& r) { return n < getName(r); });
+	return { first, last };
+}
+void IconTheme::RecordIndex::add(std::string_view name, uint16_t root, uint32_t directory) {
+	records.push_back({ (uint32_t)names.size(), (uint16_t)name.size(), root, directory });
+	names += name;
+}
+void IconTheme::RecordIndex::sort() {
+	std::stable_sort(begin(records), end(records), [this](const auto& a, const auto& b) { return getName(a) < getName(b); });
+}
+void IconTheme::RecordIndex::update(std::string_view name, uint16_t root, uint32_t directory, bool exists) {
+	auto [ first, last ] = find(name);
+	auto existing = std::find_if(first, last, [&](const auto& r) { return r.root == root && r.directory == directory; });
+	if (existing != last) records.erase(existing);
+	if (!exists) return;
+	auto [ _, position ] = find(name);
+	records.insert(position, { (uint32_t)names.size(), (uint16_t)name.size(), root, directory });
+	names += name;
+}
+
 // ==========================================
 // IconTheme
 // ==========================================
 
-void IconTheme::indexIcons(const std::vector<fs::path>& iconPaths) const {
-	std::vector<std::pair<int, fs::path>> relativePaths;
-	for (const auto& iconPath : iconPaths) {
-		fs::path indexPath = iconPath / id / "index.theme";
-		if (!fs::exists(indexPath)) continue;
-		iniFile indexFile(indexPath.native());
-		for (const auto& [ section, entries ] : indexFile) {
-			bool validFolder = true;
-			int size = 0;
+namespace {
+constexpr const char* PIXMAPS_DIR = "/usr/share/pixmaps";
+// prepare probes the names while it takes at most this many stats, beyond that the directories are listed
+constexpr uint64_t MAX_PROBES = 1024;
+
+int parseInt(std::string_view str) {
+	int value = 0;
+	std::from_chars(str.data(), str.data() + str.size(), value);
+	return value;
+}
+
+bool isRegularFile(int dirFd, const dirent64* file) {
+	if (file->d_type == DT_REG) return true;
+	if (file->d_type != DT_LNK && file->d_type != DT_UNKNOWN) return false;
+	struct stat st;
+	Stats::add(Stats::FILES_STATED);
+	return fstatat(dirFd, file->d_name, &st, 0) == 0 && S_ISREG(st.st_mode);
+}
+}
+
+void IconTheme::readIndexTheme(const iniFile& indexFile) const {
+	for (const auto& [ section, entries ] : indexFile) {
+		if (section == "Icon Theme") {
+			if (!inherits.empty()) continue;
 			for (const auto& [ name, value ] : entries) {
-				if (name == "Size") {
-					size = stoi(value);
-				} else if (name == "Type") {
-					if (value == "Scalable") {
-						validFolder = false;
-						break;
-					}
-				} else if (name == "Scale") {
-					if (stoi(value) != 1) {
-						validFolder = false;
-						break;
-					}
-				} else if (name == "Context") {
-					if (value != "Applications") {
-						validFolder = false;
-						break;
-					}
+				if (name != "Inherits") continue;
+				for (size_t pos = 0; pos < value.size();) {
+					size_t comma = std::min(value.find(',', pos), value.size());
+					// "Adwaita, hicolor" is common, the spaces around the names are not part of them
+					auto parent = value.substr(pos, comma - pos);
+					size_t first = parent.find_first_not_of(" \t");
+					parent = first == std::string_view::npos ? ""sv : parent.substr(first, parent.find_last_not_of(" \t") - first + 1);
+					if (!parent.empty() && parent != id) inherits.emplace_back(parent);
+					pos = comma + 1;
 				}
 			}
-			if (!validFolder || size == 0) continue;
-			relativePaths.emplace_back(size, section);
+			continue;
 		}
+
+		bool validFolder = true;
+		int size = 0;
+		for (const auto& [ name, value ] : entries) {
+			if (name == "Size") {
+				size = parseInt(value);
+			} else if (name == "Type") {
+				if (value == "Scalable") {
+					validFolder = false;
+					break;
+				}
+			} else if (name == "Scale") {
+				if (parseInt(value) != 1) {
+					validFolder = false;
+					break;
+				}
+			} else if (name == "Context") {
+				if (value != "Applications") {
+					validFolder = false;
+					break;
+				}
+			}
+		}
+		if (!validFolder || size == 0) continue;
+		auto known = std::find_if(begin(directories), end(directories), [section = section](const auto& d) { return d.second == section; });
+		if (known == end(directories)) directories.emplace_back(size, section);
 	}
+}
+
+// Each theme directory is opened once, the index.theme files of every theme directory are read through
+// the descriptors in one batch, then parsed in directory order. The scanned roots keep their descriptor
+// to open their icon directories.
+void IconTheme::readRoots(const std::vector<fs::path>& iconPaths) const {
+	TRACE_SCOPE("IconTheme::readRoots", id);
+	std::vector<std::pair<fs::path, int>> themeDirs;
 	for (const auto& iconPath : iconPaths) {
-		for (const auto& [size, relativePath] : relativePaths) {
-			fs::path p = iconPath / id / relativePath;
-			if (!fs::exists(p)) continue;
-			for (const auto& iconFile : fs::directory_iterator(p)) {
-				if (!iconFile.is_regular_file()) continue;
-
-				const auto& iconPath = iconFile.path();
-				if (iconPath.extension() != ".png") continue;
-				icons.emplace(iconPath.stem().native(), size, iconPath);
+		fs::path themeDir = iconPath / id;
+		int fd = open(themeDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0) continue;
+		Stats::add(Stats::FILES_OPENED);
+		themeDirs.emplace_back(std::move(themeDir), fd);
+	}
+	std::vector<FileRequest> requests;
+	for (const auto& [ themeDir, fd ] : themeDirs) requests.push_back({ fd, "index.theme" });
+	std::vector<std::optional<iniFile>> indexFiles(themeDirs.size());
+	FileReader::local().readFiles(requests, [&indexFiles](size_t index, std::unique_ptr<char[]> data, size_t size) {
+		indexFiles[index].emplace(std::move(data), size);
+	});
+	for (const auto& indexFile : indexFiles)
+		if (indexFile) readIndexTheme(*indexFile);
+
+	for (auto& [ themeDir, fd ] : themeDirs) {
+		GtkIconCache cache(themeDir);
+		if (cache.isValid()) {
+			close(fd);
+			auto dirs = cache.getDirectories();
+			std::vector<uint32_t> dirSizes;
+			for (const auto& dir : dirs) {
+				auto it = std::find_if(begin(directories), end(directories), [dir](const auto& p) { return p.second == dir; });
+				dirSizes.push_back(it == end(directories) ? 0 : it->first);
 			}
+			cachedRoots.push_back({ themeDir, std::move(cache), std::move(dirs), std::move(dirSizes) });
+			continue;
+		}
+		scannedRoots.push_back(themeDir);
+		scannedRootFds.push_back(fd);
+	}
+	Stats::add(Stats::THEME_DIRECTORIES, directories.size());
+	rootsRead = true;
+}
+
+std::vector<IconTheme::OpenDirectory> IconTheme::openDirectories() const {
+	std::vector<OpenDirectory> dirs;
+	for (uint16_t root = 0; root < scannedRoots.size(); root++) {
+		for (uint32_t directory = 0; directory < directories.size(); directory++) {
+			int fd = openat(scannedRootFds[root], directories[directory].second.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0) continue;
+			Stats::add(Stats::FILES_OPENED);
+			dirs.push_back({ root, directory, fd });
+		}
+	}
+	return dirs;
+}
+
+void IconTheme::indexIcons(const std::vector<OpenDirectory>& dirs) const {
+	TRACE_SCOPE("IconTheme::indexIcons", id);
+	for (const auto& dir : dirs) scanDirectory(dir);
+	index.sort();
+	Stats::add(Stats::THEMES_INDEXED);
+	Stats::add(Stats::THEME_ICONS, index.records.size());
+	indexed = true;
+}
+
+void IconTheme::scanDirectory(const OpenDirectory& dir) const {
+	Stats::add(Stats::DIRECTORIES_READ);
+	alignas(dirent64) char buffer[16 * 1024];
+	for (;;) {
+		ssize_t readCount = getdents64(dir.fd, buffer, sizeof buffer);
+		if (readCount <= 0) break;
+		for (ssize_t pos = 0; pos < readCount;) {
+			const auto* file = (const dirent64*)(buffer + pos);
+			pos += file->d_reclen;
+
+			std::string_view name = file->d_name;
+			if (name.size() <= 4 || name.substr(name.size() - 4) != ".png") continue;
+			if (!isRegularFile(dir.fd, file)) continue;
+			name.remove_suffix(4);
+			index.add(name, dir.root, dir.directory);
 		}
 	}
 }
+
+// The directories stay open while probing, so every probe is a single fstatat
+void IconTheme::probeIcons(const std::vector<std::string_view>& names, const std::vector<OpenDirectory>& dirs) const {
+	TRACE_SCOPE("IconTheme::probeIcons", id);
+	std::string file;
+	for (auto name : names) {
+		probedNames.emplace(name);
+		file.assign(name).append(".png");
+		for (const auto& dir : dirs) {
+			struct stat st;
+			Stats::add(Stats::ICON_PROBES);
+			if (fstatat(dir.fd, file.c_str(), &st, 0) == 0 && S_ISREG(st.st_mode)) probed.add(name, dir.root, dir.directory);
+		}
+	}
+	probed.sort();
+}
+
 IconTheme::IconTheme(std::string id) : id(id) {}
+IconTheme::~IconTheme() {
+	for (int fd : scannedRootFds) close(fd);
+}
 std::string_view IconTheme::getId() const { return id; }
+const std::vector<std::string>& IconTheme::getInherits(const std::vector<fs::path>& iconPaths) const {
+	std::call_once(rootsOnce, &IconTheme::readRoots, this, iconPaths);
+	return inherits;
+}
+bool IconTheme::prepare(const std::vector<std::string_view>& names, const std::vector<fs::path>& iconPaths) const {
+	std::call_once(rootsOnce, &IconTheme::readRoots, this, iconPaths);
+	if (indexed || scannedRoots.empty()) return false;
+	// Names with a '/' would probe other directories, they are left to the index
+	std::vector<std::string_view> newNames;
+	for (auto name : names)
+		if (!name.empty() && name.find('/') == std::string_view::npos && probedNames.count(std::string(name)) == 0) newNames.push_back(name);
+	if (newNames.empty()) return !probedNames.empty();
+
+	// Every name is probed in every directory, while listing the directories costs the same for any number
+	// of names. The size of a directory doesn't tell how many entries it has on most file systems,
+	// so the decision only counts the probes.
+	auto dirs = openDirectories();
+	bool probe = (uint64_t)newNames.size() * dirs.size() <= MAX_PROBES;
+	if (probe) {
+		Stats::add(Stats::THEMES_PROBED);
+		probeIcons(newNames, dirs);
+	} else {
+		std::call_once(indexOnce, [this, &dirs] { indexIcons(dirs); });
+	}
+	for (const auto& dir : dirs) close(dir.fd);
+	return probe;
+}
 std::vector<Icon> IconTheme::queryIcons(std::string_view name, const std::vector<fs::path>& iconPaths) const {
-	if (icons.empty()) indexIcons(iconPaths);
+	// Icon files are named name.png, so paths and empty names are never in a theme
+	if (name.empty() || name.find('/') != std::string_view::npos) return {};
+	std::call_once(rootsOnce, &IconTheme::readRoots, this, iconPaths);
+	// The names given to prepare are looked up in the probed records, the others need the full index
+	RecordIndex* records = &probed;
+	if (probedNames.count(std::string(name)) == 0) {
+		std::call_once(indexOnce, [this] {
+			auto dirs = openDirectories();
+			indexIcons(dirs);
+			for (const auto& dir : dirs) close(dir.fd);
+		});
+		records = &index;
+	}
+
 	std::vector<Icon> found;
-	const auto& [ beg, end ] = icons.equal_range(Icon(name));
-	if (beg != ::end(icons))
-		std::copy(beg, end, std::back_inserter(found));
+	auto [ first, last ] = records->find(name);
+	for (auto it = first; it != last; ++it) {
+		fs::path path = scannedRoots[it->root] / directories[it->directory].second;
+		path /= std::string(name) + ".png";
+		found.emplace_back(name, directories[it->directory].first, std::move(path));
+	}
+	for (const auto& [ themeDir, cache, dirs, dirSizes ] : cachedRoots) {
+		for (const auto& image : cache.lookup(name)) {
+			if (!(image.flags & GtkIconCache::HAS_SUFFIX_PNG)) continue;
+			if (image.directory >= dirSizes.size() || dirSizes[image.directory] == 0) continue;
+			fs::path path = themeDir / dirs[image.directory];
+			path /= std::string(name) + ".png";
+			found.emplace_back(name, dirSizes[image.directory], std::move(path));
+		}
+	}
+	auto [ firstAdded, lastAdded ] = cacheAdditions.find(name);
+	for (auto it = firstAdded; it != lastAdded; ++it) {
+		fs::path path = cachedRoots[it->root].themeDir / directories[it->directory].second;
+		path /= std::string(name) + ".png";
+		// An icon deleted and created again is also in the cache
+		if (std::any_of(begin(found), end(found), [&path](const auto& icon) { return icon.getPath() == path; })) continue;
+		found.emplace_back(name, directories[it->directory].first, std::move(path));
+	}
+	if (!removedPaths.empty()) {
+		found.erase(std::remove_if(begin(found), end(found), [this](const auto& icon) {
+			return removedPaths.count(icon.getPath()) != 0;
+		}), end(found));
+	}
 	return found;
 }
+void IconTheme::updateIcon(const fs::path& themeDir, const fs::path& file) const {
+	if (!rootsRead || file.extension() != ".png") return;
+	auto relativeDir = file.parent_path().lexically_relative(themeDir);
+	auto dir = std::find_if(begin(directories), end(directories), [&relativeDir](const auto& d) { return d.second == relativeDir; });
+	if (dir == end(directories)) return;
+	uint32_t directory = dir - begin(directories);
+
+	std::string name = file.stem();
+	std::error_code ec;
+	bool exists = fs::is_regular_file(file, ec);
+	auto root = std::find(begin(scannedRoots), end(scannedRoots), themeDir);
+	if (root != end(scannedRoots)) {
+		uint16_t rootIndex = root - begin(scannedRoots);
+		if (indexed) index.update(name, rootIndex, directory, exists);
+		if (probedNames.count(name) != 0) probed.update(name, rootIndex, directory, exists);
+	} else {
+		auto cachedRoot = std::find_if(begin(cachedRoots), end(cachedRoots), [&themeDir](const auto& r) { return r.themeDir == themeDir; });
+		if (cachedRoot == end(cachedRoots)) return;
+		cacheAdditions.update(name, cachedRoot - begin(cachedRoots), directory, exists);
+	}
+	if (exists) removedPaths.erase(file);
+	else removedPaths.insert(file);
+}
 bool IconTheme::operator==(const IconTheme& other) const { return id == other.id; }
 bool IconTheme::operator!=(const IconTheme& other) const { return !(operator==(other)); }
 
@@ -115,6 +351,7 @@ bool IconTheme::operator!=(const IconTheme& other) const { return !(operator==(o
 // ==========================================
 
 std::vector<fs::path> Icons::getIconPaths() {
+	TRACE_SCOPE("Icons::getIconPaths");
 	std::vector<fs::path> out = { getEnviroment("HOME"sv) + "/.icons" };
 	std::string data_dirs = getEnviroment("XDG_DATA_DIRS"sv);
 	if (!data_dirs.empty()) {
@@ -134,9 +371,12 @@ std::vector<fs::path> Icons::getIconPaths() {
 	return out;
 }
 std::unordered_set<IconTheme> Icons::getThemes(const std::vector<fs::path>& iconPaths) {
+	TRACE_SCOPE("Icons::getThemes");
 	std::unordered_set<IconTheme> themes;
 	for (const auto& iconPath : iconPaths) {
+		Stats::add(Stats::FILES_STATED);
 		if (!fs::exists(iconPath)) continue;
+		Stats::add(Stats::DIRECTORIES_READ);
 		auto diriter = fs::directory_iterator(iconPath);
 		for (const auto& themeFolder : diriter) {
 			if (!themeFolder.is_directory()) continue;
@@ -150,29 +390,140 @@ std::unordered_set<IconTheme> Icons::getThemes(const std::vector<fs::path>& icon
 }
 
 Icons::Icons() : iconPaths(getIconPaths()), themes(getThemes(iconPaths)) {}
-std::vector<Icon> Icons::queryIcons(std::string_view name, std::string_view preferredThemeId) {
+const std::vector<const IconTheme*>& Icons::getChain(std::string_view themeId) {
+	std::lock_guard guard(chainsLock);
+	auto [ chain, inserted ] = chains.try_emplace(std::string(themeId));
+	if (!inserted) return chain->second;
+
+	auto& found = chain->second;
+	auto visit = [&](auto& self, const std::string& id) -> void {
+		auto theme = themes.find(IconTheme(id));
+		if (theme == themes.end()) return;
+		if (std::find(begin(found), end(found), &*theme) != end(found)) return;
+		found.push_back(&*theme);
+		for (const auto& parent : theme->getInherits(iconPaths)) self(self, parent);
+	};
+	if (!themeId.empty()) visit(visit, std::string(themeId));
+	visit(visit, "hicolor");
+	return found;
+}
+void Icons::indexPixmaps() {
+	TRACE_SCOPE("Icons::indexPixmaps");
+	Stats::add(Stats::DIRECTORIES_READ);
+	std::error_code ec;
+	for (const auto& file : fs::directory_iterator(PIXMAPS_DIR, ec)) {
+		if (file.path().extension() != ".png" || !file.is_regular_file(ec)) continue;
+		pixmaps.try_emplace(file.path().stem(), Pixmap{ file.path(), std::nullopt });
+	}
+}
+std::vector<Icon> Icons::queryFiles(std::string_view name) {
+	auto squareSize = [](const fs::path& path) -> uint32_t {
+		auto size = PngReader::readSize(path);
+		return size && size->first == size->second ? size->first : 0;
+	};
+
 	std::vector<Icon> icons;
-	if (!preferredThemeId.empty()) {
-		auto preferredTheme = themes.find(IconTheme(std::string(preferredThemeId)));
-		if (preferredTheme != themes.end())
-			icons = preferredTheme->queryIcons(name, iconPaths);
-		if (!icons.empty()) return icons;
+	if (!name.empty() && name.front() == '/') {
+		fs::path path = name;
+		if (path.extension() != ".png") return icons;
+		uint32_t size = squareSize(path);
+		if (size != 0) icons.emplace_back(name, size, std::move(path));
+		return icons;
 	}
 
-	auto hicolorTheme = themes.find(IconTheme("hicolor"));
-	if (hicolorTheme != themes.end())
-		icons = hicolorTheme->queryIcons(name, iconPaths);
-	if (!icons.empty()) return icons;
+	std::call_once(*pixmapsOnce, &Icons::indexPixmaps, this);
+	auto pixmap = pixmaps.find(std::string(name));
+	if (pixmap == end(pixmaps)) return icons;
+	std::lock_guard guard(lookupLock);
+	auto& [ path, size ] = pixmap->second;
+	if (!size) size = squareSize(path);
+	if (*size != 0) icons.emplace_back(name, *size, path);
+	return icons;
+}
+std::vector<fs::path> Icons::getWatchDirs() {
+	// The directories that don't exist yet are included, the preferred theme and hicolor may be installed later
+	std::vector<std::string_view> themeIds = { ICON_THEME };
+	for (const auto* theme : getChain(ICON_THEME)) themeIds.push_back(theme->getId());
+	themeIds.push_back("hicolor");
+	std::vector<fs::path> dirs;
+	for (auto themeId : themeIds) {
+		for (const auto& iconPath : iconPaths) {
+			fs::path dir = iconPath / themeId;
+			if (std::find(begin(dirs), end(dirs), dir) == end(dirs)) dirs.push_back(std::move(dir));
+		}
+	}
+	dirs.push_back(PIXMAPS_DIR);
+	return dirs;
+}
+void Icons::updateIcon(const fs::path& file) {
+	{
+		std::lock_guard guard(lookupLock);
+		misses.erase(file.stem());
+		if (file.parent_path() == PIXMAPS_DIR) {
+			std::error_code ec;
+			if (file.extension() == ".png" && fs::is_regular_file(file, ec)) {
+				pixmaps.insert_or_assign(file.stem(), Pixmap{ file, std::nullopt });
+			} else {
+				auto pixmap = pixmaps.find(file.stem());
+				if (pixmap != end(pixmaps) && pixmap->second.path == file) pixmaps.erase(pixmap);
+			}
+			return;
+		}
+	}
+	for (const auto& iconPath : iconPaths) {
+		auto relative = file.lexically_relative(iconPath);
+		if (relative.empty() || *begin(relative) == "..") continue;
+		auto theme = themes.find(IconTheme(*begin(relative)));
+		if (theme != themes.end()) theme->updateIcon(iconPath / theme->getId(), file);
+		return;
+	}
+}
+void Icons::reindex() {
+	std::lock_guard guard(chainsLock);
+	chains.clear();
+	themes = getThemes(iconPaths);
+	std::lock_guard lookupGuard(lookupLock);
+	misses.clear();
+	pixmaps.clear();
+	pixmapsOnce = std::make_unique<std::once_flag>();
+}
+void Icons::prepare(const std::vector<std::string_view>& names, std::string_view preferredThemeId) {
+	TRACE_SCOPE("Icons::prepare");
+	std::vector<std::string_view> remaining;
+	std::unordered_set<std::string_view> seen;
+	for (auto name : names)
+		if (!name.empty() && name.front() != '/' && seen.insert(name).second) remaining.push_back(name);
+	// The names found in a theme are not looked up in the themes after it
+	for (const auto* theme : getChain(preferredThemeId)) {
+		if (remaining.empty()) break;
+		theme->prepare(remaining, iconPaths);
+		remaining.erase(std::remove_if(begin(remaining), end(remaining), [this, theme](std::string_view name) {
+			return !theme->queryIcons(name, iconPaths).empty();
+		}), end(remaining));
+	}
+}
+std::vector<Icon> Icons::queryIcons(std::string_view name, std::string_view preferredThemeId) {
+	Stats::add(Stats::ICON_QUERIES);
+	{
+		std::lock_guard guard(lookupLock);
+		if (misses.count(std::string(name)) != 0) {
+			Stats::add(Stats::ICON_NOT_FOUND);
+			return {};
+		}
+	}
 
-	if (!fs::exists("/usr/share/pixmaps")) return icons;
-	for (auto icon : fs::directory_iterator("/usr/share/pixmaps")) {
-		if (icon.path().stem() != name) continue;
-		if (icon.path().extension() != ".png") continue;
-		PngReader p(icon.path());
-		if (p.getWidth() != p.getHeight()) continue;
-		icons.emplace_back(name, p.getWidth(), icon.path());
+	std::vector<Icon> icons;
+	for (const auto* theme : getChain(preferredThemeId)) {
+		icons = theme->queryIcons(name, iconPaths);
+		if (!icons.empty()) return icons;
 	}
 
+	icons = queryFiles(name);
+	if (icons.empty()) {
+		Stats::add(Stats::ICON_NOT_FOUND);
+		std::lock_guard guard(lookupLock);
+		misses.emplace(name);
+	}
 	return icons;
 }
 
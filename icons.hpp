@@ -1,6 +1,9 @@
 #pragma once
 
+#include <mutex>
 #include <optional>
+#include "gtkIconCache.hpp"
+#include "iniParse.hpp"
 #include "utils.hpp"
 
 // https://specifications.freedesktop.org/icon-theme-spec/icon-theme-spec-latest.html
@@ -10,8 +13,6 @@ class Icon {
 	std::string name;
 	uint32_t size;
 	fs::path path;
-
-	std::string escapeData(const std::vector<uint8_t>& png) const;
 public:
 	Icon(std::string_view name);
 	Icon(std::string_view name, uint32_t size, fs::path path);
@@ -19,7 +20,9 @@ public:
 	std::string_view getName() const;
 	uint32_t getSize() const;
 	const fs::path& getPath() const;
-	std::string dmenuString() const;
+	std::string dmenuString(uint32_t size = 16) const;
+	// Appends the escaped icon data to out, reusing per-thread scratch buffers
+	void renderDmenu(std::string& out, uint32_t size = 16) const;
 
 	bool operator==(const Icon& other) const;
 	bool operator!=(const Icon& other) const;
@@ -34,16 +37,87 @@ template<> struct hash<Icon> {
 }
 
 class IconTheme {
-	std::string id;
-	mutable std::unordered_multiset<Icon> icons;
+	// A theme directory indexed through its icon-theme.cache, dirSizes maps the cache directories to icon sizes
+	struct CachedRoot {
+		fs::path themeDir;
+		GtkIconCache cache;
+		std::vector<std::string_view> dirs;
+		std::vector<uint32_t> dirSizes;
+	};
+	// An icon found in a theme directory without a cache, the path is
+	// scannedRoots[root] / directories[directory] / name.png, or cachedRoots[root].themeDir / ...
+	// for the icons created in a cached root
+	struct IconRecord {
+		uint32_t nameOffset;
+		uint16_t nameLength;
+		uint16_t root;
+		uint32_t directory;
+	};
+	// Records sorted by name, their names are stored in one string
+	struct RecordIndex {
+		std::string names;
+		std::vector<IconRecord> records;
+
+		std::string_view getName(const IconRecord& record) const;
+		std::pair<std::vector<IconRecord>::iterator, std::vector<IconRecord>::iterator> find(std::string_view name);
+		void add(std::string_view name, uint16_t root, uint32_t directory);
+		void sort();
+		// Adds or removes the record of the icon after it was created or deleted
+		void update(std::string_view name, uint16_t root, uint32_t directory, bool exists);
+	};
+	// An icon directory of a scanned root, opened to be listed or probed
+	struct OpenDirectory {
+		uint16_t root;
+		uint32_t directory;
+		int fd;
+	};
 
-	void indexIcons(const std::vector<fs::path>& iconPaths) const;
+	std::string id;
+	// The theme directories and their index.theme are read on first use, the icons are either indexed
+	// on the first query or probed by prepare. Queries can come from multiple threads.
+	mutable std::once_flag rootsOnce;
+	mutable std::once_flag indexOnce;
+	mutable bool rootsRead = false;
+	mutable bool indexed = false;
+	mutable std::vector<std::string> inherits;
+	mutable std::vector<std::pair<int, fs::path>> directories;
+	mutable std::vector<fs::path> scannedRoots;
+	// The descriptors of the scanned roots, kept from readRoots so that every root is opened once
+	mutable std::vector<int> scannedRootFds;
+	mutable std::vector<CachedRoot> cachedRoots;
+	// Every icon of the scanned roots
+	mutable RecordIndex index;
+	// The icons of the names given to prepare, when probing them was cheaper than indexing
+	mutable RecordIndex probed;
+	mutable std::unordered_set<std::string> probedNames;
+	// Icons created in the cached roots after readRoots, which their icon-theme.cache doesn't list
+	mutable RecordIndex cacheAdditions;
+	// Icons deleted after indexing, used to mask the entries of the icon-theme.cache files
+	mutable std::unordered_set<std::string> removedPaths;
+
+	void readRoots(const std::vector<fs::path>& iconPaths) const;
+	void readIndexTheme(const iniFile& indexFile) const;
+	std::vector<OpenDirectory> openDirectories() const;
+	void indexIcons(const std::vector<OpenDirectory>& dirs) const;
+	void scanDirectory(const OpenDirectory& dir) const;
+	void probeIcons(const std::vector<std::string_view>& names, const std::vector<OpenDirectory>& dirs) const;
 public:
 	IconTheme(std::string id);
+	IconTheme(const IconTheme&) = delete;
+	~IconTheme();
 
 	std::string_view getId() const;
+	// The themes named by the Inherits key of index.theme
+	const std::vector<std::string>& getInherits(const std::vector<fs::path>& iconPaths) const;
 
+	// Looks up the icons of names ahead of the queries for them. When the names are few enough, the
+	// candidate paths are probed instead of listing the directories.
+	// Returns whether the names were probed. Must not run concurrently with queries.
+	bool prepare(const std::vector<std::string_view>& names, const std::vector<fs::path>& iconPaths) const;
 	std::vector<Icon> queryIcons(std::string_view name, const std::vector<fs::path>& iconPaths) const;
+	// Patches the index after file, in the theme directory themeDir, was created or deleted.
+	// Must not run concurrently with queries.
+	void updateIcon(const fs::path& themeDir, const fs::path& file) const;
 
 	bool operator==(const IconTheme& other) const;
 	bool operator!=(const IconTheme& other) const;
@@ -60,12 +134,41 @@ template<> struct hash<IconTheme> {
 class Icons {
 	std::vector<fs::path> iconPaths;
 	std::unordered_set<IconTheme> themes;
+	// The themes searched for each preferred theme: the theme, the themes it inherits from
+	// depth first, then hicolor. Resolved on first use.
+	std::mutex chainsLock;
+	std::unordered_map<std::string, std::vector<const IconTheme*>> chains;
+
+	// The PNGs of the pixmaps directory by name, indexed on the first lookup that misses the themes.
+	// Sizes are read from the PNG header when the pixmap is first used, 0 means not square or unreadable.
+	// reindex replaces the flag so that the directory is indexed again.
+	struct Pixmap {
+		fs::path path;
+		std::optional<uint32_t> size;
+	};
+	std::unique_ptr<std::once_flag> pixmapsOnce = std::make_unique<std::once_flag>();
+	std::unordered_map<std::string, Pixmap> pixmaps;
+	// Guards the pixmap sizes and misses, the names that resolved to no icon
+	std::mutex lookupLock;
+	std::unordered_set<std::string> misses;
 
 	std::vector<fs::path> getIconPaths();
 	std::unordered_set<IconTheme> getThemes(const std::vector<fs::path>& iconPaths);
+	const std::vector<const IconTheme*>& getChain(std::string_view themeId);
+	void indexPixmaps();
+	// Icons given by an absolute path or found in the pixmaps directory
+	std::vector<Icon> queryFiles(std::string_view name);
 public:
 	Icons();
 
-	std::vector<Icon> queryIcons(std::string_view name, std::string_view preferredThemeId = "");
-	std::optional<Icon> queryIconClosestSize(std::string_view name, uint32_t size, std::string_view preferredThemeId = "");
+	// The directories whose changes affect the lookups, including the ones that don't exist yet
+	std::vector<fs::path> getWatchDirs();
+	void updateIcon(const fs::path& file);
+	void reindex();
+
+	// Prepares the themes of the chain for queries of names, see IconTheme::prepare.
+	// Must not run concurrently with queries.
+	void prepare(const std::vector<std::string_view>& names, std::string_view preferredThemeId = ICON_THEME);
+	std::vector<Icon> queryIcons(std::string_view name, std::string_view preferredThemeId = ICON_THEME);
+	std::optional<Icon> queryIconClosestSize(std::string_view name, uint32_t size, std::string_view preferredThemeId = ICON_THEME);
 };
@@ -1,116 +1,114 @@
 #include "iniParse.hpp"
 
-#include <fstream>
+#include <cstring>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+
 // FIXME: this is not compliant with the freedesktop spec
 // https://specifications.freedesktop.org/desktop-entry-spec/latest/ar01s03.html
 
-// ==========================================
-// iniFile::iniEntry
-// ==========================================
-
-iniFile::iniEntry::iniEntry() = default;
-iniFile::iniEntry::iniEntry(std::string_view name) : name(name) {}
+namespace {
+constexpr std::string_view WHITESPACE = "\t\n\v\f\r ";
 
-void iniFile::iniEntry::clear() {
-	name.clear();
-	value.clear();
+std::string_view trim(std::string_view str) {
+	size_t first = str.find_first_not_of(WHITESPACE);
+	if (first == std::string_view::npos) return {};
+	return str.substr(first, str.find_last_not_of(WHITESPACE) - first + 1);
 }
-void iniFile::iniEntry::trim() {
-	name.substr(0, name.find_last_not_of("\t\n\v\f\r ") + 1);
-	if (!value.empty()) value.substr(value.find_first_not_of("\t\n\v\f\r "));
 }
 
+// ==========================================
+// iniFile::iniEntry
+// ==========================================
+
 bool iniFile::iniEntry::operator==(const iniEntry& other) const { return name == other.name; }
 bool iniFile::iniEntry::operator!=(const iniEntry& other) const { return !(operator==(other)); }
 
 // ==========================================
-// iniFile::iniSection
+// iniFile::iniEntries
 // ==========================================
 
-iniFile::iniSection::iniSection() = default;
-iniFile::iniSection::iniSection(std::string_view section) : section(section) {}
+const iniFile::iniEntry* iniFile::iniEntries::begin() const { return first; }
+const iniFile::iniEntry* iniFile::iniEntries::end() const { return last; }
+size_t iniFile::iniEntries::size() const { return last - first; }
 
-void iniFile::iniSection::clear() {
-	section.clear();
-	entries.clear();
-}
+// ==========================================
+// iniFile::iniSection
+// ==========================================
 
 bool iniFile::iniSection::operator==(const iniSection& other) const { return section == other.section; }
 bool iniFile::iniSection::operator!=(const iniSection& other) const { return !(operator==(other)); }
+bool iniFile::iniSection::operator==(std::string_view name) const { return section == name; }
+bool iniFile::iniSection::operator!=(std::string_view name) const { return !(operator==(name)); }
 
 // ==========================================
 // iniFile
 // ==========================================
 
-std::vector<iniFile::iniSection> iniFile::parseFile(std::string_view path) {
-	std::vector<iniSection> tmp;
-
-	std::ifstream file(path.data());
-
-	enum { SECTION, OPT, OPT_VALUE, LINE_END } state;
-	std::string line;
-	iniSection section;
-	iniEntry entry;
-
-	for (;;) {
-		if (!getline(file, line))  break;
-
-		if (line.empty()) continue;
-
-		switch (line[0]) {
-			case '[':
-				state = SECTION;
-				sections.push_back(section);
-				section.clear();
-				break;
-			case '#': 
-				continue;
-			default:
-				state = OPT;
-				entry.name += line[0];
-				break;
-		}
-
-		for (size_t i = 1; i < line.size(); i++) {
-			const char c = line[i];
-			switch (state) {
-			case SECTION:
-				if (c == ']') state = LINE_END;
-				else section.section += c;
-				break;
-			case OPT:
-				if (c == '=') state = OPT_VALUE;
-				else entry.name += c;
-				break;
-			case OPT_VALUE:
-				entry.value += c;
-				break;
-			case LINE_END:
-				// error?
-				break;
-			}
+void iniFile::readFile(int dirFd, std::string_view path) {
+	int fd = openat(dirFd, path.data(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return;
+	Stats::add(Stats::FILES_OPENED);
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		data = std::make_unique<char[]>(st.st_size);
+		while (size < (size_t)st.st_size) {
+			ssize_t readCount = read(fd, data.get() + size, st.st_size - size);
+			if (readCount <= 0) break;
+			size += readCount;
 		}
+	}
+	close(fd);
+	Stats::add(Stats::BYTES_READ, size);
+}
 
-		if (state == OPT_VALUE) {
-			entry.trim();
-			section.entries.push_back(entry);
-			entry.clear();
+void iniFile::parse() {
+	// Sections only record the index of their first entry while parsing, since entries can still be reallocated
+	std::vector<std::pair<std::string_view, size_t>> sectionStarts;
+	entries.reserve(size / 32 + 1);
+
+	const char* pos = data.get();
+	const char* const fileEnd = pos + size;
+	while (pos < fileEnd) {
+		const char* lineEnd = (const char*)memchr(pos, '\n', fileEnd - pos);
+		if (!lineEnd) lineEnd = fileEnd;
+		std::string_view line = trim({ pos, (size_t)(lineEnd - pos) });
+		pos = lineEnd + 1;
+
+		if (line.empty() || line[0] == '#') continue;
+		if (line[0] == '[') {
+			size_t closing = line.find(']');
+			if (closing == std::string_view::npos) continue;
+			sectionStarts.emplace_back(line.substr(1, closing - 1), entries.size());
+			continue;
 		}
-		// error
+		// Entries before the first section are ignored
+		if (sectionStarts.empty()) continue;
+		const char* equals = (const char*)memchr(line.data(), '=', line.size());
+		if (!equals) continue;
+		size_t nameLength = equals - line.data();
+		entries.push_back({ trim(line.substr(0, nameLength)), trim(line.substr(nameLength + 1)) });
 	}
 
-	if (section.entries.size() != 0)
-		sections.push_back(section);
-
-	if (sections[0].entries.size() == 0)
-		sections.erase(sections.begin());
+	sections.reserve(sectionStarts.size());
+	for (size_t i = 0; i < sectionStarts.size(); i++) {
+		size_t last = i + 1 < sectionStarts.size() ? sectionStarts[i + 1].second : entries.size();
+		sections.push_back({ sectionStarts[i].first, { entries.data() + sectionStarts[i].second, entries.data() + last } });
+	}
+}
 
-	return tmp;
+iniFile::iniFile(std::string_view path) : iniFile(AT_FDCWD, path) {}
+iniFile::iniFile(int dirFd, std::string_view path) {
+	readFile(dirFd, path);
+	parse();
 }
-iniFile::iniFile(std::string_view path) : sections(parseFile(path)) {}
+iniFile::iniFile(std::unique_ptr<char[]> data, size_t size) : data(std::move(data)), size(size) { parse(); }
 std::vector<iniFile::iniSection>::const_iterator iniFile::begin() const { return sections.begin(); }
 std::vector<iniFile::iniSection>::const_iterator iniFile::end() const { return sections.end(); }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -7,37 +8,48 @@
 // FIXME: this is not compliant with the freedesktop spec
 // https://specifications.freedesktop.org/desktop-entry-spec/latest/ar01s03.html
 
+// The file is read with a single read, sections and entries are views into that buffer.
 class iniFile {
 	struct iniEntry {
-		std::string name, value; 
-
-		iniEntry();
-		iniEntry(std::string_view name);
-
-		void clear();
-		void trim();
+		std::string_view name, value;
 
 		bool operator==(const iniEntry& other) const;
 		bool operator!=(const iniEntry& other) const;
 	};
-	struct iniSection { 
-		std::string section;
-		std::vector<iniEntry> entries; 
-
-		iniSection();
-		iniSection(std::string_view section);
+	struct iniEntries {
+		const iniEntry* first;
+		const iniEntry* last;
 
-		void clear();
+		const iniEntry* begin() const;
+		const iniEntry* end() const;
+		size_t size() const;
+	};
+	struct iniSection {
+		std::string_view section;
+		iniEntries entries;
 
 		bool operator==(const iniSection& other) const;
 		bool operator!=(const iniSection& other) const;
+		bool operator==(std::string_view name) const;
+		bool operator!=(std::string_view name) const;
 	};
 
+	std::unique_ptr<char[]> data;
+	size_t size = 0;
+	std::vector<iniEntry> entries;
 	std::vector<iniSection> sections;
 
-	std::vector<iniSection> parseFile(std::string_view path);
+	void readFile(int dirFd, std::string_view path);
+	void parse();
 public:
+	// A file that cannot be read results in an empty iniFile
 	iniFile(std::string_view path);
+	// Reads path relative to the directory dirFd
+	iniFile(int dirFd, std::string_view path);
+	iniFile(std::unique_ptr<char[]> data, size_t size);
+	iniFile(const iniFile&) = delete;
+	iniFile(iniFile&&) = default;
+
 	std::vector<iniSection>::const_iterator begin() const;
 	std::vector<iniSection>::const_iterator end() const;
 };
@@ -0,0 +1,20 @@
+#include "menu.hpp"
+
+#include "iconPipeline.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+void renderMenu(const DesktopEntries& entries, Icons& icons, IconBlobCache& iconCache, const SegmentWriter& write) {
+	renderMenu(std::vector<DesktopEntryView>(::begin(entries), ::end(entries)), icons, iconCache, write);
+}
+
+void renderMenu(const std::vector<DesktopEntryView>& entries, Icons& icons, IconBlobCache& iconCache, const SegmentWriter& write) {
+	TRACE_SCOPE("renderMenu");
+	IconPipeline pipeline(entries, icons, iconCache);
+	size_t i = 0;
+	for (const auto& entry : entries) {
+		auto icon = pipeline.get(i++);
+		if (icon) write({ entry.getName(), "\0"sv, *icon, "\n"sv });
+		else write({ entry.getName(), "\n"sv });
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <functional>
+#include <initializer_list>
+#include "desktopEntries.hpp"
+#include "iconBlobCache.hpp"
+#include "icons.hpp"
+#include "utils.hpp"
+
+using SegmentWriter = std::function<void(std::initializer_list<std::string_view>)>;
+
+// Renders one dmenu line per entry, in order: the name, then a NUL and the icon payload if the entry has one.
+// The segments passed to write stay valid as long as entries and iconCache.
+void renderMenu(const DesktopEntries& entries, Icons& icons, IconBlobCache& iconCache, const SegmentWriter& write);
+// Renders only the given entries, the icons of the other entries are never resolved
+void renderMenu(const std::vector<DesktopEntryView>& entries, Icons& icons, IconBlobCache& iconCache, const SegmentWriter& write);
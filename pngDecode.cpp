@@ -0,0 +1,263 @@
+#include "pngDecode.hpp"
+#include <cstring>
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+#include "utils.hpp"
+
+namespace {
+constexpr uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+// The default limits of libpng, larger images are left to it so that they fail the same way
+constexpr uint32_t MAX_DIMENSION = 1000000;
+
+enum ColorType : uint8_t { RGB = 2, RGBA = 6 };
+enum Filter : uint8_t { NONE, SUB, UP, AVERAGE, PAETH };
+
+uint32_t read32(const uint8_t* data) {
+	return (uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+bool readFile(const fs::path& path, std::vector<uint8_t>& data) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+	Stats::add(Stats::FILES_OPENED);
+	struct stat st;
+	size_t size = 0;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		data.resize(st.st_size);
+		while (size < data.size()) {
+			ssize_t readCount = read(fd, data.data() + size, data.size() - size);
+			if (readCount <= 0) break;
+			size += readCount;
+		}
+	}
+	close(fd);
+	Stats::add(Stats::BYTES_READ, size);
+	data.resize(size);
+	return size > 0;
+}
+
+// ==========================================
+// Unfiltering
+// ==========================================
+
+// Each filter predicts a byte from a, the byte one pixel to the left, b, the byte above, and c, the byte above a.
+// Up has no dependency between the bytes of a row, the other filters depend on the previous pixel and handle a
+// whole pixel at a time.
+
+void unfilterUp(uint8_t* row, const uint8_t* prev, size_t size) {
+	size_t i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= size; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+		_mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+	}
+#endif
+	for (; i < size; i++) row[i] += prev[i];
+}
+
+#ifdef __SSE2__
+template<size_t BPP> __m128i loadPixel(const uint8_t* p) {
+	uint32_t value = 0;
+	memcpy(&value, p, BPP);
+	return _mm_cvtsi32_si128(value);
+}
+template<size_t BPP> void storePixel(uint8_t* p, __m128i pixel) {
+	uint32_t value = _mm_cvtsi128_si32(pixel);
+	memcpy(p, &value, BPP);
+}
+__m128i ifThenElse(__m128i condition, __m128i then, __m128i otherwise) {
+	return _mm_or_si128(_mm_and_si128(condition, then), _mm_andnot_si128(condition, otherwise));
+}
+__m128i abs16(__m128i x) { return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x)); }
+
+template<size_t BPP> void unfilterSub(uint8_t* row, size_t size) {
+	__m128i a = _mm_setzero_si128();
+	for (size_t i = 0; i < size; i += BPP) {
+		a = _mm_add_epi8(a, loadPixel<BPP>(row + i));
+		storePixel<BPP>(row + i, a);
+	}
+}
+
+template<size_t BPP> void unfilterAverage(uint8_t* row, const uint8_t* prev, size_t size) {
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i a = _mm_setzero_si128();
+	for (size_t i = 0; i < size; i += BPP) {
+		__m128i b = loadPixel<BPP>(prev + i);
+		// _mm_avg_epu8 rounds up, the filter rounds down
+		__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		a = _mm_add_epi8(average, loadPixel<BPP>(row + i));
+		storePixel<BPP>(row + i, a);
+	}
+}
+
+template<size_t BPP> void unfilterPaeth(uint8_t* row, const uint8_t* prev, size_t size) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero, c = zero;
+	for (size_t i = 0; i < size; i += BPP) {
+		__m128i b = _mm_unpacklo_epi8(loadPixel<BPP>(prev + i), zero);
+		__m128i x = loadPixel<BPP>(row + i);
+		// p = a + b - c, pa = |p - a| = |b - c|, pb = |p - b| = |a - c|, pc = |p - c| = |(b - c) + (a - c)|
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = abs16(_mm_add_epi16(pa, pb));
+		pa = abs16(pa);
+		pb = abs16(pb);
+		__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		__m128i nearest = ifThenElse(_mm_cmpeq_epi16(smallest, pa), a, ifThenElse(_mm_cmpeq_epi16(smallest, pb), b, c));
+		__m128i decoded = _mm_add_epi8(_mm_packus_epi16(nearest, nearest), x);
+		storePixel<BPP>(row + i, decoded);
+		a = _mm_unpacklo_epi8(decoded, zero);
+		c = b;
+	}
+}
+#else
+template<size_t BPP> void unfilterSub(uint8_t* row, size_t size) {
+	for (size_t i = BPP; i < size; i++) row[i] += row[i - BPP];
+}
+
+template<size_t BPP> void unfilterAverage(uint8_t* row, const uint8_t* prev, size_t size) {
+	for (size_t i = 0; i < size; i++) row[i] += ((i >= BPP ? row[i - BPP] : 0) + prev[i]) >> 1;
+}
+
+template<size_t BPP> void unfilterPaeth(uint8_t* row, const uint8_t* prev, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		int a = i >= BPP ? row[i - BPP] : 0, b = prev[i], c = i >= BPP ? prev[i - BPP] : 0;
+		int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+		row[i] += pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+	}
+}
+#endif
+
+template<size_t BPP> bool unfilter(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t size) {
+	switch (filter) {
+	case NONE: return true;
+	case SUB: unfilterSub<BPP>(row, size); return true;
+	case UP: unfilterUp(row, prev, size); return true;
+	case AVERAGE: unfilterAverage<BPP>(row, prev, size); return true;
+	case PAETH: unfilterPaeth<BPP>(row, prev, size); return true;
+	default: return false;
+	}
+}
+
+// ==========================================
+// Decoding
+// ==========================================
+
+struct Header {
+	uint32_t width, height;
+	uint8_t colorType;
+};
+
+// Inflates the IDAT chunks into rows, only the current and the previous row are kept
+class RowDecoder {
+	Header header;
+	size_t bpp, stride;
+	std::vector<uint8_t>& pixels;
+	// Each row is the filter byte followed by the filtered pixels
+	std::vector<uint8_t> current, previous;
+	size_t filled = 0;
+	uint32_t y = 0;
+	z_stream stream = {};
+	bool initialized = false;
+
+	bool finishRow() {
+		bool ok = bpp == 4 ? unfilter<4>(current[0], current.data() + 1, previous.data() + 1, stride)
+			: unfilter<3>(current[0], current.data() + 1, previous.data() + 1, stride);
+		if (!ok) return false;
+		uint8_t* out = pixels.data() + (size_t)y * header.width * 4;
+		if (bpp == 4) {
+			memcpy(out, current.data() + 1, stride);
+		} else {
+			const uint8_t* in = current.data() + 1;
+			for (uint32_t x = 0; x < header.width; x++) {
+				memcpy(out + x * 4, in + x * 3, 3);
+				out[x * 4 + 3] = 0xff;
+			}
+		}
+		std::swap(current, previous);
+		filled = 0;
+		y++;
+		return true;
+	}
+public:
+	RowDecoder(const Header& header, std::vector<uint8_t>& pixels) :
+		header(header), bpp(header.colorType == RGBA ? 4 : 3), stride(header.width * bpp), pixels(pixels),
+		current(stride + 1), previous(stride + 1) {
+		initialized = inflateInit(&stream) == Z_OK;
+	}
+	RowDecoder(const RowDecoder&) = delete;
+	~RowDecoder() {
+		if (initialized) inflateEnd(&stream);
+	}
+
+	bool isDone() const { return y == header.height; }
+
+	bool feed(const uint8_t* data, size_t size) {
+		if (!initialized) return false;
+		stream.next_in = const_cast<uint8_t*>(data);
+		stream.avail_in = size;
+		while (!isDone() && stream.avail_in > 0) {
+			stream.next_out = current.data() + filled;
+			stream.avail_out = current.size() - filled;
+			int status = inflate(&stream, Z_NO_FLUSH);
+			filled = current.size() - stream.avail_out;
+			if (filled == current.size() && !finishRow()) return false;
+			if (status == Z_STREAM_END) return isDone();
+			if (status != Z_OK) return false;
+		}
+		return true;
+	}
+};
+}
+
+bool decodeSimplePng(const fs::path& path, std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height) {
+	thread_local std::vector<uint8_t> file;
+	if (!readFile(path, file)) return false;
+	const uint8_t* data = file.data();
+	const size_t size = file.size();
+	if (size < 8 + 25 || memcmp(data, SIGNATURE, sizeof SIGNATURE) != 0) return false;
+
+	// IHDR: u32 width, u32 height, u8 depth, colorType, compression, filter, interlace
+	const uint8_t* ihdr = data + 8;
+	if (read32(ihdr) != 13 || memcmp(ihdr + 4, "IHDR", 4) != 0) return false;
+	if (crc32(0, ihdr + 4, 17) != read32(ihdr + 21)) return false;
+	Header header = { read32(ihdr + 8), read32(ihdr + 12), ihdr[17] };
+	if (header.width == 0 || header.height == 0 || header.width > MAX_DIMENSION || header.height > MAX_DIMENSION) return false;
+	// The image is allocated up front, the size comes from the file so it's capped before that
+	if ((uint64_t)header.width * header.height > MAX_ICON_PIXELS) return false;
+	if (ihdr[16] != 8 || (header.colorType != RGB && header.colorType != RGBA) || ihdr[18] || ihdr[19] || ihdr[20]) return false;
+
+	pixels.resize((size_t)header.width * header.height * 4);
+	RowDecoder decoder(header, pixels);
+	for (size_t pos = 8 + 25; !decoder.isDone();) {
+		if (pos + 12 > size) return false;
+		const uint32_t length = read32(data + pos);
+		const uint8_t* type = data + pos + 4;
+		const uint8_t* chunk = data + pos + 8;
+		if (length > size - pos - 12) return false;
+		pos += length + 12;
+
+		if (memcmp(type, "IDAT", 4) == 0) {
+			if (crc32(0, type, length + 4) != read32(chunk + length)) return false;
+			if (!decoder.feed(chunk, length)) return false;
+		} else if (memcmp(type, "tRNS", 4) == 0 || memcmp(type, "IEND", 4) == 0) {
+			return false;
+		} else if (!(type[0] & 0x20) && memcmp(type, "PLTE", 4) != 0) {
+			// An unknown critical chunk
+			return false;
+		}
+	}
+	width = header.width;
+	height = header.height;
+	return true;
+}
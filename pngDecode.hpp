@@ -0,0 +1,10 @@
+#pragma once
+
+#include "utils.hpp"
+
+// Decoder for the PNGs most icons are: 8-bit RGB or RGBA, not interlaced and without tRNS.
+// The compressed data is inflated with zlib one row at a time into two row buffers and unfiltered with SSE2,
+// the result is the RGBA image that libpng gives PngReader for the same file.
+// Returns false, possibly after writing to pixels, for any other file so that it can be read with libpng,
+// and for images over MAX_ICON_PIXELS before allocating them.
+bool decodeSimplePng(const fs::path& path, std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height);
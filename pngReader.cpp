@@ -1,6 +1,42 @@
 #include "pngReader.hpp"
+#include <algorithm>
+#include <cstring>
 #include <png.h>
-PngReader::PngReader(const fs::path& path) : path(path), infoRead(false) {}
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "escape.hpp"
+#include "pngDecode.hpp"
+#include "resample.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+namespace {
+// The default read function of libpng, counting the bytes read
+void readData(png_struct* png, png_byte* data, size_t length) {
+	if (fread(data, 1, length, (FILE*)png_get_io_ptr(png)) != length) png_error(png, "read error");
+	Stats::add(Stats::BYTES_READ, length);
+}
+}
+
+std::optional<std::pair<uint32_t, uint32_t>> PngReader::readSize(const fs::path& path) {
+	// The signature is followed by the IHDR chunk: u32 length, "IHDR", u32 width, u32 height (big endian)
+	uint8_t header[24];
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return std::nullopt;
+	ssize_t readCount = pread(fd, header, sizeof header, 0);
+	close(fd);
+	Stats::add(Stats::FILES_OPENED);
+	Stats::add(Stats::BYTES_READ, std::max<ssize_t>(readCount, 0));
+	if (readCount != sizeof header || png_sig_cmp(header, 0, 8) || memcmp(header + 12, "IHDR", 4) != 0) return std::nullopt;
+	auto read32 = [&header](size_t offset) {
+		return (uint32_t)header[offset] << 24 | header[offset + 1] << 16 | header[offset + 2] << 8 | header[offset + 3];
+	};
+	return std::make_pair(read32(16), read32(20));
+}
+
+PngReader::PngReader(const fs::path& path) : path(path) {}
 
 void PngReader::getImgInfo() {
 	if (infoRead) return;
@@ -8,7 +44,8 @@ void PngReader::getImgInfo() {
 	fp = fopen(path.c_str(), "rb");
 	uint8_t header[8];
 	if (!fp) throw std::invalid_argument("cannot open file");
-	fread(header, 8, 1, fp);
+	Stats::add(Stats::FILES_OPENED);
+	Stats::add(Stats::BYTES_READ, fread(header, 1, 8, fp));
 	if (png_sig_cmp(header, 0, 8)) throw std::invalid_argument("file is not a PNG");
 
 	png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
@@ -16,7 +53,7 @@ void PngReader::getImgInfo() {
 	info = png_create_info_struct(png);
 	if (!info) throw std::runtime_error("png_create_info_struct failed");
 
-	png_init_io(png, fp);
+	png_set_read_fn(png, fp, readData);
 	png_set_sig_bytes(png, 8);
 	
 	png_read_info(png, info);
@@ -24,12 +61,23 @@ void PngReader::getImgInfo() {
 	infoRead = true;
 }
 
-void PngReader::readPixels() {	
-	getImgInfo();
+void PngReader::readPixels() {
 	if (!pixels.empty()) return;
+	readPixels(pixels);
+}
+
+void PngReader::readPixels(std::vector<uint8_t>& target) {
+	TRACE_SCOPE("PngReader::decode", path.native());
+	Stats::add(Stats::PNG_DECODES);
+	// Most icons are 8-bit RGB(A), they are decoded without setting up libpng
+	if (!infoRead && decodeSimplePng(path, target, width, height)) return;
+	getImgInfo();
 
 	const uint32_t w = png_get_image_width(png, info);
 	const uint32_t h = png_get_image_height(png, info);
+	if ((uint64_t)w * h > MAX_ICON_PIXELS) throw std::runtime_error("image is too large");
+	width = w;
+	height = h;
 	const uint8_t colorType = png_get_color_type(png, info);
 	const uint8_t depth = png_get_bit_depth(png, info);
 
@@ -39,44 +87,41 @@ void PngReader::readPixels() {
 	else if (colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA) png_set_gray_to_rgb(png);
 
 	if (png_get_valid(png, info, PNG_INFO_tRNS)) png_set_tRNS_to_alpha(png);
+	else if (!(colorType & PNG_COLOR_MASK_ALPHA)) png_set_add_alpha(png, 0xff, PNG_FILLER_AFTER);
 
 	png_read_update_info(png, info);
 
 	size_t rowbytes = png_get_rowbytes(png, info);
-	pixels = std::vector<uint8_t>(h * rowbytes, 0);
-	uint8_t* rows[h];
-	for (uint32_t y = 0; y < h; y++) rows[y] = pixels.data() + rowbytes * y;
-	png_read_image(png, rows);
+	target.resize((size_t)h * rowbytes);
+	std::vector<png_byte*> rows(h);
+	for (uint32_t y = 0; y < h; y++) rows[y] = target.data() + rowbytes * y;
+	png_read_image(png, rows.data());
 }
 
 PngReader::~PngReader() {
-	png_destroy_read_struct(&png, &info, nullptr);
-	fclose(fp);
+	if (png) png_destroy_read_struct(&png, &info, nullptr);
+	if (fp) fclose(fp);
 }
 
 const std::vector<uint8_t>& PngReader::getPixels() { readPixels(); return pixels; }
 std::vector<uint8_t> PngReader::getScaledPixels(uint32_t newW, uint32_t newH) {
 	readPixels();
-	const uint32_t w = png_get_image_width(png, info);
-	const uint32_t h = png_get_image_height(png, info);
-
-	if (newW == w && newH == h) return pixels;	
+	if (newW == width && newH == height) return pixels;
+	return resample(pixels.data(), width, height, newW, newH);
+}
 
-	float xratio = (float)w / newW;
-	float yratio = (float)h / newH;
-	std::vector<uint8_t> scaled;
-	scaled.reserve(newW * newH * 4);
-	
-	for (uint32_t y = 0; y < newH; y++)
-		for (uint32_t x = 0; x < newW; x++) {
-			uint32_t index = (y * yratio * w + x * xratio) * 4;
-			scaled.push_back(pixels[index + 0]);
-			scaled.push_back(pixels[index + 1]);
-			scaled.push_back(pixels[index + 2]);
-			scaled.push_back(pixels[index + 3]);
-		}
-
-	return scaled;
+void PngReader::renderScaled(uint32_t newW, uint32_t newH, ResampleScratch& scratch, std::string& out) {
+	readPixels(scratch.source);
+	if (newW == width && newH == height) {
+		appendEscaped(out, scratch.source.data(), scratch.source.size());
+		return;
+	}
+	scratch.row.resize((size_t)newW * 4);
+	Resampler resampler(scratch.source.data(), width, height, newW, newH, scratch);
+	for (uint32_t y = 0; y < newH; y++) {
+		resampler.row(y, scratch.row.data());
+		appendEscaped(out, scratch.row.data(), scratch.row.size());
+	}
 }
 
 uint32_t PngReader::getWidth() { getImgInfo(); return png_get_image_width(png, info); }
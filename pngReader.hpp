@@ -1,24 +1,36 @@
 #pragma once
+#include <optional>
 #include <png.h>
 
 #include "utils.hpp"
 
+struct ResampleScratch;
+
 class PngReader {
 	fs::path path;
 	std::vector<uint8_t> pixels;
-	FILE* fp;
-	png_struct* png;
-	png_info* info;
-	bool infoRead;
+	FILE* fp = nullptr;
+	png_struct* png = nullptr;
+	png_info* info = nullptr;
+	bool infoRead = false;
+	// The size of the decoded image
+	uint32_t width = 0, height = 0;
 
 	void getImgInfo();
 	void readPixels();
+	void readPixels(std::vector<uint8_t>& target);
 public:
+	// Reads the size from the IHDR chunk without decoding the image, nullopt if the file is not a PNG
+	static std::optional<std::pair<uint32_t, uint32_t>> readSize(const fs::path& path);
+
 	PngReader(const fs::path& path);
 	~PngReader();
 
 	const std::vector<uint8_t>& getPixels();
 	std::vector<uint8_t> getScaledPixels(uint32_t newW, uint32_t newH);
+	// Scales the image row by row and appends the rows escaped for dmenu to out, the decoded image and the
+	// resampling buffers are kept in scratch so that rendering many icons only allocates while they grow
+	void renderScaled(uint32_t newW, uint32_t newH, ResampleScratch& scratch, std::string& out);
 	uint32_t getWidth();
 	uint32_t getHeight();
 	uint8_t getDepth();
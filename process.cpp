@@ -1,12 +1,18 @@
 #include "process.hpp"
+#include <algorithm>
+#include <cerrno>
 #include <stdexcept>
 #include <streambuf>
 #include <initializer_list>
 
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <climits>
 #include <cstring>
 #include <unistd.h>
 
+#include "stats.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 namespace detail {
@@ -15,32 +21,109 @@ namespace detail {
 // iopipes::PipeFds
 // ==========================================
 
+namespace {
+void closeFd(int& fd) {
+	if (fd >= 0) ::close(fd);
+	fd = -1;
+}
+}
+
 iopipes::PipeFds::PipeFds() { pipe(fds); }
-void iopipes::PipeFds::close() { ::close(readEnd); ::close(writeEnd); }
+void iopipes::PipeFds::close() { closeFd(readEnd); closeFd(writeEnd); }
 iopipes::PipeFds::~PipeFds() { close(); }
 
 // ==========================================
 // iopipes
 // ==========================================
 
-iopipes::iopipes() : std::iostream(this) { setg(buffer, buffer, buffer); }
-void iopipes::sendEOF() { opipe.close(); }
+namespace {
+// Segments smaller than this are copied in the buffer, since an iovec would cost more than the copy
+constexpr size_t COPY_THRESHOLD = 256;
+}
+
+iopipes::iopipes() : std::iostream(this), segmentStart(outBuffer) {
+	setg(buffer, buffer, buffer);
+	setp(outBuffer, outBuffer + sizeof outBuffer);
+}
+void iopipes::closeBufferedSegment() {
+	if (pptr() == segmentStart) return;
+	segments.push_back({ segmentStart, (size_t)(pptr() - segmentStart) });
+	segmentStart = pptr();
+}
+void iopipes::writeSegments(std::initializer_list<std::string_view> data) {
+	if (bad()) return;
+	for (auto segment : data) {
+		if (segment.size() < COPY_THRESHOLD) {
+			if ((size_t)(epptr() - pptr()) < segment.size() && !flush()) {
+				setstate(std::ios::badbit);
+				return;
+			}
+			memcpy(pptr(), segment.data(), segment.size());
+			pbump(segment.size());
+		} else {
+			closeBufferedSegment();
+			segments.push_back({ (void*)segment.data(), segment.size() });
+		}
+	}
+	if (segments.size() >= IOV_MAX - 1 && !flush()) setstate(std::ios::badbit);
+}
+bool iopipes::flush() {
+	TRACE_SCOPE("pipe write");
+	closeBufferedSegment();
+	bool ok = true;
+	for (size_t first = 0; ok && first < segments.size();) {
+		int count = std::min(segments.size() - first, (size_t)IOV_MAX);
+		ssize_t written = ::writev(opipe.writeEnd, segments.data() + first, count);
+		Stats::add(Stats::PIPE_WRITES);
+		if (written < 0) {
+			ok = errno == EINTR;
+			continue;
+		}
+		Stats::add(Stats::PIPE_BYTES, written);
+		// Skip the segments that were written completely and adjust the partially written one
+		for (; first < segments.size() && (size_t)written >= segments[first].iov_len; first++)
+			written -= segments[first].iov_len;
+		if (written > 0) {
+			segments[first].iov_base = (char*)segments[first].iov_base + written;
+			segments[first].iov_len -= written;
+		}
+	}
+	segments.clear();
+	setp(outBuffer, outBuffer + sizeof outBuffer);
+	segmentStart = outBuffer;
+	return ok;
+}
+void iopipes::sendEOF() {
+	if (!flush()) setstate(std::ios::badbit);
+	opipe.close();
+}
 void iopipes::close() { ipipe.close(); opipe.close(); }
-void iopipes::closeUnneded() { ::close(ipipe.writeEnd); ::close(opipe.readEnd); }
-void iopipes::dup() {
-	dup2(ipipe.writeEnd, STDOUT_FILENO);
-	dup2(opipe.readEnd, STDIN_FILENO);
-	close();
+void iopipes::closeUnneded() { closeFd(ipipe.writeEnd); closeFd(opipe.readEnd); }
+void iopipes::addSpawnActions(posix_spawn_file_actions_t* actions) {
+	posix_spawn_file_actions_adddup2(actions, ipipe.writeEnd, STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(actions, opipe.readEnd, STDIN_FILENO);
+	for (int fd : { ipipe.readEnd, ipipe.writeEnd, opipe.readEnd, opipe.writeEnd })
+		if (fd >= 0) posix_spawn_file_actions_addclose(actions, fd);
 }
 iopipes::traits::int_type iopipes::overflow(traits::int_type c) {
-	if (c == traits::eof()) return traits::eof();
-	if (::write(opipe.writeEnd, &c, 1) != 1) return traits::eof();
+	if (!flush()) return traits::eof();
+	if (c == traits::eof()) return traits::not_eof(c);
+	*pptr() = traits::to_char_type(c);
+	pbump(1);
 	return c;
 }
 std::streamsize iopipes::xsputn(const char* data, std::streamsize len) {
-	ssize_t writeret = ::write(opipe.writeEnd, data, len);
-	return writeret == -1 ? traits::eof() : writeret;
+	if (len <= epptr() - pptr()) {
+		memcpy(pptr(), data, len);
+		pbump(len);
+		return len;
+	}
+	// The data doesn't fit, it's written by reference together with the buffered output
+	closeBufferedSegment();
+	segments.push_back({ (void*)data, (size_t)len });
+	return flush() ? len : 0;
 }
+int iopipes::sync() { return flush() ? 0 : -1; }
 int iopipes::underflow() {
 	if (gptr() == egptr()) {
 		ssize_t readCount = ::read(ipipe.readEnd, gptr(), sizeof buffer);
@@ -70,14 +153,14 @@ Process::Process(std::string_view file, std::string_view arg0, std::vector<std::
 	file(file), argv(prepend(args, arg0)) {}
 Process::Process(std::string_view file, std::vector<std::string_view> args) : 
 	file(file), argv(prepend(args, file)) {}
+// posix_spawn avoids copying the page tables of the parent, which fork does even if exec follows right away
 void Process::run() {
-	int exitCode;
-	pid = fork();
-	if (pid == 0) {
-		pipes.dup();
-		int ret = execvp(file.c_str(), (char**)argv.carray());
-		exit(1);
-	}
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	pipes.addSpawnActions(&actions);
+	int error = posix_spawnp(&pid, file.c_str(), &actions, nullptr, (char**)argv.carray(), environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (error != 0) throw std::runtime_error("Cannot spawn " + file + ": " + strerror(error));
 	pipes.closeUnneded();
 }
 void Process::exec() {
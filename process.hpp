@@ -1,6 +1,8 @@
 #pragma once
 
+#include <spawn.h>
 #include <streambuf>
+#include <sys/uio.h>
 #include "utils.hpp"
 
 namespace detail {
@@ -17,16 +19,30 @@ class iopipes : std::streambuf, public std::iostream {
 	} ipipe, opipe;
 
 	char buffer[1024];
+
+	// Output is collected in outBuffer and in segments queued by reference, then written with writev.
+	// segments lists, in order, the regions of outBuffer before segmentStart and the queued segments.
+	char outBuffer[64 * 1024];
+	char* segmentStart;
+	std::vector<iovec> segments;
+
+	void closeBufferedSegment();
 public:
 	iopipes();
 
+	// Queues the segments, the ones larger than a few bytes are not copied so they must stay valid until the next flush.
+	// A failed write sets badbit and the following segments are dropped, like a failed write through the stream.
+	void writeSegments(std::initializer_list<std::string_view> data);
+	bool flush();
 	void sendEOF();
 	void close();
 	void closeUnneded();
-	void dup();
+	// Makes the spawned process use the pipes as its stdin and stdout
+	void addSpawnActions(posix_spawn_file_actions_t* actions);
 protected:
 	virtual traits::int_type overflow(traits::int_type c);
 	virtual std::streamsize xsputn(const char* data, std::streamsize len);
+	virtual int sync();
 	virtual int underflow();
 };
 
@@ -0,0 +1,302 @@
+#include "resample.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLE_X86
+#endif
+
+#include "utils.hpp"
+
+namespace {
+// Adds a row of bytes to a row of 16 bit sums, used to sum the source rows of an integer ratio
+using AccumulateFn = void (*)(uint16_t* sums, const uint8_t* row, size_t count);
+
+void accumulateScalar(uint16_t* sums, const uint8_t* row, size_t count) {
+	for (size_t i = 0; i < count; i++) sums[i] += row[i];
+}
+
+#ifdef RESAMPLE_X86
+__attribute__((target("sse2")))
+void accumulateSse2(uint16_t* sums, const uint8_t* row, size_t count) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(row + i));
+		__m128i low = _mm_loadu_si128((const __m128i*)(sums + i));
+		__m128i high = _mm_loadu_si128((const __m128i*)(sums + i + 8));
+		low = _mm_add_epi16(low, _mm_unpacklo_epi8(bytes, zero));
+		high = _mm_add_epi16(high, _mm_unpackhi_epi8(bytes, zero));
+		_mm_storeu_si128((__m128i*)(sums + i), low);
+		_mm_storeu_si128((__m128i*)(sums + i + 8), high);
+	}
+	accumulateScalar(sums + i, row + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void accumulateAvx2(uint16_t* sums, const uint8_t* row, size_t count) {
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256i low = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + i)));
+		__m256i high = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + i + 16)));
+		low = _mm256_add_epi16(low, _mm256_loadu_si256((const __m256i*)(sums + i)));
+		high = _mm256_add_epi16(high, _mm256_loadu_si256((const __m256i*)(sums + i + 16)));
+		_mm256_storeu_si256((__m256i*)(sums + i), low);
+		_mm256_storeu_si256((__m256i*)(sums + i + 16), high);
+	}
+	accumulateScalar(sums + i, row + i, count - i);
+}
+#endif
+
+// Adds a row of bytes times a Q16 weight to a row of 32 bit sums, the vertical pass of the area filter
+using AccumulateWeightedFn = void (*)(uint32_t* sums, const uint8_t* row, size_t count, uint32_t weight);
+
+void accumulateWeightedScalar(uint32_t* sums, const uint8_t* row, size_t count, uint32_t weight) {
+	for (size_t i = 0; i < count; i++) sums[i] += row[i] * weight;
+}
+
+// Sums the RGBA pixels of a row of 32 bit sums at offsets times their Q16 weights, the horizontal pass of the
+// area filter. The sums are 64 bit since the pixels are Q16 already.
+using SumTapsFn = void (*)(uint64_t out[4], const uint32_t* sums, const uint32_t* offsets, const uint32_t* weights, uint32_t count);
+
+void sumTapsScalar(uint64_t out[4], const uint32_t* sums, const uint32_t* offsets, const uint32_t* weights, uint32_t count) {
+	out[0] = out[1] = out[2] = out[3] = 0;
+	for (uint32_t i = 0; i < count; i++)
+		for (uint32_t c = 0; c < 4; c++) out[c] += (uint64_t)sums[offsets[i] * 4 + c] * weights[i];
+}
+
+// Multiplies the colors of a row of RGBA pixels by their alpha, rounding like c * a / 255.
+// Averaging premultiplied colors keeps the color of transparent pixels from bleeding into the visible ones.
+using PremultiplyFn = void (*)(uint8_t* out, const uint8_t* row, size_t pixels);
+
+void premultiplyScalar(uint8_t* out, const uint8_t* row, size_t pixels) {
+	for (size_t x = 0; x < pixels; x++) {
+		uint32_t alpha = row[x * 4 + 3];
+		for (uint32_t c = 0; c < 3; c++) {
+			uint32_t product = row[x * 4 + c] * alpha + 128;
+			out[x * 4 + c] = (product + (product >> 8)) >> 8;
+		}
+		out[x * 4 + 3] = alpha;
+	}
+}
+
+#ifdef RESAMPLE_X86
+__attribute__((target("sse2")))
+void premultiplySse2(uint8_t* out, const uint8_t* row, size_t pixels) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i half = _mm_set1_epi16(128);
+	const __m128i alphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	// Two pixels in 16 bit lanes
+	auto premultiplyPair = [&](__m128i values) {
+		__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(values, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i product = _mm_add_epi16(_mm_mullo_epi16(values, alpha), half);
+		product = _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+		return _mm_or_si128(_mm_andnot_si128(alphaMask, product), _mm_and_si128(alphaMask, values));
+	};
+	size_t x = 0;
+	for (; x + 4 <= pixels; x += 4) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(row + x * 4));
+		__m128i low = premultiplyPair(_mm_unpacklo_epi8(bytes, zero));
+		__m128i high = premultiplyPair(_mm_unpackhi_epi8(bytes, zero));
+		_mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(low, high));
+	}
+	premultiplyScalar(out + x * 4, row + x * 4, pixels - x);
+}
+
+// The products of bytes and 16 bit weights are assembled from their low and high halves,
+// a weight of one only occurs when the source and destination have the same height
+__attribute__((target("sse2")))
+void accumulateWeightedSse2(uint32_t* sums, const uint8_t* row, size_t count, uint32_t weight) {
+	if (weight > 0xffff) return accumulateWeightedScalar(sums, row, count, weight);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i factor = _mm_set1_epi16((short)weight);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i values = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + i)), zero);
+		__m128i low = _mm_mullo_epi16(values, factor);
+		__m128i high = _mm_mulhi_epu16(values, factor);
+		__m128i first = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sums + i)), _mm_unpacklo_epi16(low, high));
+		__m128i second = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sums + i + 4)), _mm_unpackhi_epi16(low, high));
+		_mm_storeu_si128((__m128i*)(sums + i), first);
+		_mm_storeu_si128((__m128i*)(sums + i + 4), second);
+	}
+	accumulateWeightedScalar(sums + i, row + i, count - i, weight);
+}
+
+__attribute__((target("sse2")))
+void sumTapsSse2(uint64_t out[4], const uint32_t* sums, const uint32_t* offsets, const uint32_t* weights, uint32_t count) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i low = zero, high = zero;
+	for (uint32_t i = 0; i < count; i++) {
+		__m128i pixel = _mm_loadu_si128((const __m128i*)(sums + offsets[i] * 4));
+		__m128i weight = _mm_set1_epi32(weights[i]);
+		low = _mm_add_epi64(low, _mm_mul_epu32(_mm_unpacklo_epi32(pixel, zero), weight));
+		high = _mm_add_epi64(high, _mm_mul_epu32(_mm_unpackhi_epi32(pixel, zero), weight));
+	}
+	_mm_storeu_si128((__m128i*)out, low);
+	_mm_storeu_si128((__m128i*)(out + 2), high);
+}
+
+__attribute__((target("avx2")))
+void accumulateWeightedAvx2(uint32_t* sums, const uint8_t* row, size_t count, uint32_t weight) {
+	const __m256i factor = _mm256_set1_epi32(weight);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(row + i));
+		__m256i first = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(bytes), factor);
+		__m256i second = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)), factor);
+		first = _mm256_add_epi32(first, _mm256_loadu_si256((const __m256i*)(sums + i)));
+		second = _mm256_add_epi32(second, _mm256_loadu_si256((const __m256i*)(sums + i + 8)));
+		_mm256_storeu_si256((__m256i*)(sums + i), first);
+		_mm256_storeu_si256((__m256i*)(sums + i + 8), second);
+	}
+	accumulateWeightedScalar(sums + i, row + i, count - i, weight);
+}
+
+__attribute__((target("avx2")))
+void sumTapsAvx2(uint64_t out[4], const uint32_t* sums, const uint32_t* offsets, const uint32_t* weights, uint32_t count) {
+	__m256i total = _mm256_setzero_si256();
+	for (uint32_t i = 0; i < count; i++) {
+		__m256i pixel = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(sums + offsets[i] * 4)));
+		total = _mm256_add_epi64(total, _mm256_mul_epu32(pixel, _mm256_set1_epi64x(weights[i])));
+	}
+	_mm256_storeu_si256((__m256i*)out, total);
+}
+#endif
+
+struct Kernels {
+	PremultiplyFn premultiply = premultiplyScalar;
+	AccumulateFn accumulate = accumulateScalar;
+	AccumulateWeightedFn accumulateWeighted = accumulateWeightedScalar;
+	SumTapsFn sumTaps = sumTapsScalar;
+};
+
+Kernels selectKernels() {
+#ifdef RESAMPLE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return { premultiplySse2, accumulateAvx2, accumulateWeightedAvx2, sumTapsAvx2 };
+	if (__builtin_cpu_supports("sse2")) return { premultiplySse2, accumulateSse2, accumulateWeightedSse2, sumTapsSse2 };
+#endif
+	return {};
+}
+const Kernels kernels = selectKernels();
+
+// Divides the averaged colors by the averaged alpha, the sums are in units of 1 / area
+void writeUnpremultiplied(uint8_t* dst, const uint64_t sums[4], uint64_t area) {
+	uint64_t alpha = sums[3];
+	for (uint32_t c = 0; c < 3; c++)
+		dst[c] = alpha == 0 ? 0 : std::min<uint64_t>((sums[c] * 255 + alpha / 2) / alpha, 255);
+	dst[3] = std::min<uint64_t>((alpha + area / 2) / area, 255);
+}
+
+constexpr uint32_t ONE = 1 << 16;
+// 16 bit sums of bytes can hold up to 257 rows
+constexpr uint32_t MAX_RATIO = 257;
+}
+
+// ==========================================
+// Resampler
+// ==========================================
+
+// Destination pixel i covers the source interval [i * size, (i + 1) * size), in units of 1 / newSize pixels
+void Resampler::computeWeights(ResampleScratch::Weights& weights, uint32_t size, uint32_t newSize) {
+	weights.first.clear();
+	weights.offsets.clear();
+	weights.weights.clear();
+	for (uint64_t i = 0; i < newSize; i++) {
+		weights.first.push_back(weights.offsets.size());
+		uint64_t start = i * size, end = (i + 1) * size;
+		uint32_t total = 0;
+		for (uint64_t s = start / newSize; s * newSize < end; s++) {
+			uint64_t overlap = std::min(end, (s + 1) * newSize) - std::max(start, s * newSize);
+			uint32_t weight = overlap * ONE / size;
+			weights.offsets.push_back(s);
+			weights.weights.push_back(weight);
+			total += weight;
+		}
+		// The rounding error goes to the last pixel so that the weights always sum to one
+		weights.weights.back() += ONE - total;
+	}
+	weights.first.push_back(weights.offsets.size());
+}
+
+Resampler::Resampler(const uint8_t* src, uint32_t w, uint32_t h, uint32_t newW, uint32_t newH, ResampleScratch& scratch) :
+	src(src), w(w), h(h), newW(newW), newH(newH), scratch(scratch) {
+	// The same size is copied, premultiplying would only lose precision
+	if (newW > w || newH > h || (newW == w && newH == h)) {
+		mode = NEAREST;
+	} else if (w % newW == 0 && h % newH == 0 && w / newW == h / newH && w / newW <= MAX_RATIO) {
+		mode = INTEGER_RATIO;
+		ratio = w / newW;
+		scratch.rowSums.resize(w * 4);
+		scratch.premultiplied.resize(w * 4);
+	} else {
+		mode = AREA;
+		computeWeights(scratch.xWeights, w, newW);
+		computeWeights(scratch.yWeights, h, newH);
+		scratch.accumulator.resize(w * 4);
+		scratch.premultiplied.resize(w * 4);
+	}
+}
+
+void Resampler::nearestRow(uint32_t y, uint8_t* dst) const {
+	const uint8_t* srcRow = src + (uint64_t)y * h / newH * w * 4;
+	for (uint32_t x = 0; x < newW; x++)
+		memcpy(dst + x * 4, srcRow + (uint64_t)x * w / newW * 4, 4);
+}
+
+void Resampler::integerRatioRow(uint32_t y, uint8_t* dst) {
+	auto& rowSums = scratch.rowSums;
+	std::fill(begin(rowSums), end(rowSums), 0);
+	uint8_t* premultiplied = scratch.premultiplied.data();
+	for (uint32_t sy = y * ratio; sy < (y + 1) * ratio; sy++) {
+		kernels.premultiply(premultiplied, src + (size_t)sy * w * 4, w);
+		kernels.accumulate(rowSums.data(), premultiplied, w * 4);
+	}
+
+	const uint32_t area = ratio * ratio;
+	for (uint32_t x = 0; x < newW; x++) {
+		const uint16_t* block = rowSums.data() + x * ratio * 4;
+		uint64_t sums[4] = {};
+		for (uint32_t i = 0; i < ratio; i++)
+			for (uint32_t c = 0; c < 4; c++) sums[c] += block[i * 4 + c];
+		writeUnpremultiplied(dst + x * 4, sums, area);
+	}
+}
+
+void Resampler::areaRow(uint32_t y, uint8_t* dst) {
+	const auto& xWeights = scratch.xWeights;
+	const auto& yWeights = scratch.yWeights;
+	auto& accumulator = scratch.accumulator;
+	std::fill(begin(accumulator), end(accumulator), 0);
+	uint8_t* premultiplied = scratch.premultiplied.data();
+	for (uint32_t i = yWeights.first[y]; i < yWeights.first[y + 1]; i++) {
+		kernels.premultiply(premultiplied, src + (size_t)yWeights.offsets[i] * w * 4, w);
+		kernels.accumulateWeighted(accumulator.data(), premultiplied, w * 4, yWeights.weights[i]);
+	}
+
+	// Both weights are Q16 and sum to one, so the sums are Q32
+	for (uint32_t x = 0; x < newW; x++) {
+		uint32_t first = xWeights.first[x];
+		uint64_t sums[4];
+		kernels.sumTaps(sums, accumulator.data(), xWeights.offsets.data() + first, xWeights.weights.data() + first, xWeights.first[x + 1] - first);
+		writeUnpremultiplied(dst + x * 4, sums, 1ull << 32);
+	}
+}
+
+void Resampler::row(uint32_t y, uint8_t* dst) {
+	switch (mode) {
+	case NEAREST: nearestRow(y, dst); break;
+	case INTEGER_RATIO: integerRatioRow(y, dst); break;
+	case AREA: areaRow(y, dst); break;
+	}
+}
+
+std::vector<uint8_t> resample(const uint8_t* src, uint32_t w, uint32_t h, uint32_t newW, uint32_t newH) {
+	std::vector<uint8_t> out((size_t)newW * newH * 4);
+	ResampleScratch scratch;
+	Resampler resampler(src, w, h, newW, newH, scratch);
+	for (uint32_t y = 0; y < newH; y++) resampler.row(y, out.data() + (size_t)y * newW * 4);
+	return out;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "utils.hpp"
+
+// Downscaling of 8-bit RGBA images, used to render the icons.
+// Shrinking averages the covered source area with premultiplied alpha in fixed point, exact integer ratios
+// (like 64 -> 16) take a fast path that sums the source rows. Both use SSE2/AVX2 kernels selected at runtime.
+// Enlarging uses the nearest neighbour.
+
+// Buffers used while resampling, reusing them between images avoids allocating once they are large enough
+struct ResampleScratch {
+	// Fixed point (Q16) weights of the source pixels covering each destination pixel
+	struct Weights {
+		std::vector<uint32_t> first;
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> weights;
+	} xWeights, yWeights;
+	std::vector<uint32_t> accumulator;
+	std::vector<uint16_t> rowSums;
+	// A source row with premultiplied alpha
+	std::vector<uint8_t> premultiplied;
+	// Decoded source image and destination row, filled by the callers
+	std::vector<uint8_t> source;
+	std::vector<uint8_t> row;
+};
+
+class Resampler {
+	const uint8_t* src;
+	uint32_t w, h;
+	uint32_t newW, newH;
+	enum { NEAREST, INTEGER_RATIO, AREA } mode;
+	uint32_t ratio = 1;
+	ResampleScratch& scratch;
+
+	static void computeWeights(ResampleScratch::Weights& weights, uint32_t size, uint32_t newSize);
+	void nearestRow(uint32_t y, uint8_t* dst) const;
+	void integerRatioRow(uint32_t y, uint8_t* dst);
+	void areaRow(uint32_t y, uint8_t* dst);
+public:
+	Resampler(const uint8_t* src, uint32_t w, uint32_t h, uint32_t newW, uint32_t newH, ResampleScratch& scratch);
+
+	// Renders the destination row y, dst must have room for newW * 4 bytes
+	void row(uint32_t y, uint8_t* dst);
+};
+
+std::vector<uint8_t> resample(const uint8_t* src, uint32_t w, uint32_t h, uint32_t newW, uint32_t newH);
@@ -0,0 +1,51 @@
+#include "stats.hpp"
+
+#include "utils.hpp"
+
+namespace {
+constexpr std::array<std::string_view, Stats::COUNTER_COUNT> COUNTER_NAMES = {
+	"directories_read",
+	"files_stated",
+	"files_opened",
+	"bytes_read",
+	"entries_parsed",
+	"theme_directories",
+	"theme_icons",
+	"themes_indexed",
+	"themes_probed",
+	"icon_probes",
+	"icon_queries",
+	"icon_not_found",
+	"icon_cache_hits",
+	"icon_cache_misses",
+	"png_decodes",
+	"pipe_bytes",
+	"pipe_writes",
+};
+}
+
+std::array<std::atomic<uint64_t>, Stats::COUNTER_COUNT> Stats::counters{};
+std::atomic<bool> Stats::reportEnabled{ false };
+Stats::Format Stats::reportFormat = Stats::Format::TEXT;
+
+uint64_t Stats::get(Counter counter) { return counters[counter].load(std::memory_order_relaxed); }
+
+void Stats::print(std::ostream& out, Format format) {
+	if (format == Format::JSON) {
+		out << '{';
+		for (size_t i = 0; i < COUNTER_COUNT; i++)
+			out << (i ? ",\"" : "\"") << COUNTER_NAMES[i] << "\":" << get((Counter)i);
+		out << "}\n";
+		return;
+	}
+	for (size_t i = 0; i < COUNTER_COUNT; i++)
+		out << COUNTER_NAMES[i] << std::string(20 - COUNTER_NAMES[i].size(), ' ') << get((Counter)i) << '\n';
+}
+
+void Stats::enableReport(Format format) {
+	reportFormat = format;
+	reportEnabled = true;
+}
+void Stats::report() {
+	if (reportEnabled.exchange(false)) print(std::cerr, reportFormat);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <ostream>
+#include "utils.hpp"
+
+// Counters of the work done during a run, reported on stderr with --stats (or --stats=json).
+// They are relaxed atomics, cheap enough to stay enabled everywhere.
+class Stats {
+public:
+	enum Counter {
+		DIRECTORIES_READ,
+		FILES_STATED,
+		FILES_OPENED,
+		BYTES_READ,
+		ENTRIES_PARSED,
+		THEME_DIRECTORIES,
+		THEME_ICONS,
+		THEMES_INDEXED,
+		THEMES_PROBED,
+		ICON_PROBES,
+		ICON_QUERIES,
+		ICON_NOT_FOUND,
+		ICON_CACHE_HITS,
+		ICON_CACHE_MISSES,
+		PNG_DECODES,
+		PIPE_BYTES,
+		PIPE_WRITES,
+		COUNTER_COUNT
+	};
+	enum class Format { TEXT, JSON };
+private:
+	static std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters;
+	static std::atomic<bool> reportEnabled;
+	static Format reportFormat;
+public:
+	static void add(Counter counter, uint64_t value = 1) { counters[counter].fetch_add(value, std::memory_order_relaxed); }
+	static uint64_t get(Counter counter);
+	static void print(std::ostream& out, Format format);
+
+	// report prints the counters to stderr once enableReport was called
+	static void enableReport(Format format);
+	static void report();
+};
@@ -0,0 +1,61 @@
+#include "threadPool.hpp"
+#include <algorithm>
+#include <system_error>
+
+#include "utils.hpp"
+
+void ThreadPool::work() {
+	std::unique_lock guard(lock);
+	for (;;) {
+		taskReady.wait(guard, [this] { return stopping || !tasks.empty(); });
+		if (tasks.empty()) return;
+		auto task = std::move(tasks.front());
+		tasks.pop_front();
+		running++;
+		guard.unlock();
+		task();
+		guard.lock();
+		if (--running == 0 && tasks.empty()) tasksDone.notify_all();
+	}
+}
+
+ThreadPool::ThreadPool(unsigned threads) {
+	threads = resolveThreadCount(threads);
+	if (threads <= 1) return;
+	workers.reserve(threads);
+	try {
+		for (unsigned i = 0; i < threads; i++) workers.emplace_back(&ThreadPool::work, this);
+	} catch (const std::system_error&) {
+		// Keep the workers that could be started, or fall back to running inline
+	}
+}
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard guard(lock);
+		stopping = true;
+	}
+	taskReady.notify_all();
+	for (auto& worker : workers) worker.join();
+}
+
+unsigned ThreadPool::resolveThreadCount(unsigned threads) {
+	if (threads != 0) return threads;
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+size_t ThreadPool::size() const { return std::max(workers.size(), (size_t)1); }
+
+void ThreadPool::submit(std::function<void()> task) {
+	if (workers.empty()) {
+		task();
+		return;
+	}
+	{
+		std::lock_guard guard(lock);
+		tasks.push_back(std::move(task));
+	}
+	taskReady.notify_one();
+}
+void ThreadPool::wait() {
+	std::unique_lock guard(lock);
+	tasksDone.wait(guard, [this] { return tasks.empty() && running == 0; });
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "utils.hpp"
+
+// Fixed size pool of worker threads.
+// With a single thread, or if no thread could be started, the tasks run inline in submit.
+class ThreadPool {
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex lock;
+	std::condition_variable taskReady, tasksDone;
+	size_t running = 0;
+	bool stopping = false;
+
+	void work();
+public:
+	// A thread count of 0 uses the number of cores
+	ThreadPool(unsigned threads = WORKER_THREADS);
+	ThreadPool(const ThreadPool&) = delete;
+	~ThreadPool();
+
+	static unsigned resolveThreadCount(unsigned threads);
+	size_t size() const;
+
+	void submit(std::function<void()> task);
+	// Waits for all the submitted tasks to complete
+	void wait();
+};
@@ -0,0 +1,94 @@
+#include "trace.hpp"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+#include <unistd.h>
+
+#include "utils.hpp"
+
+namespace {
+struct Event {
+	const char* name;
+	std::string detail;
+	uint32_t thread;
+	uint64_t start, end;
+};
+
+std::mutex eventsLock;
+std::vector<Event> events;
+fs::path traceFile;
+std::chrono::steady_clock::time_point origin;
+std::atomic<uint32_t> threadCount{ 0 };
+
+uint32_t getThreadId() {
+	thread_local uint32_t id = ++threadCount;
+	return id;
+}
+
+void writeJsonString(std::ostream& out, std::string_view str) {
+	std::string quoted;
+	appendJsonString(quoted, str);
+	out << quoted;
+}
+}
+
+// ==========================================
+// Tracer
+// ==========================================
+
+std::atomic<bool> Tracer::enabled{ false };
+
+void Tracer::start(const fs::path& file) {
+	std::lock_guard guard(eventsLock);
+	traceFile = file;
+	origin = std::chrono::steady_clock::now();
+	events.clear();
+	enabled.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::finish() {
+	if (!isEnabled()) return;
+	enabled.store(false, std::memory_order_relaxed);
+	std::lock_guard guard(eventsLock);
+	// The trace is a diagnostic, failing to write it must not keep the entry from launching
+	std::ofstream out(traceFile);
+	if (!out) {
+		std::cerr << "Cannot write the trace to " << traceFile.native() << '\n';
+		events.clear();
+		return;
+	}
+
+	const int pid = getpid();
+	out << "{\"traceEvents\":[\n";
+	out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"desktop-dmenu\"}}";
+	for (const auto& event : events) {
+		char times[64];
+		// Timestamps are in microseconds
+		snprintf(times, sizeof times, "\"ts\":%.3f,\"dur\":%.3f", event.start / 1000.0, (event.end - event.start) / 1000.0);
+		out << ",\n{\"name\":";
+		writeJsonString(out, event.name);
+		out << ",\"cat\":\"desktop-dmenu\",\"ph\":\"X\"," << times << ",\"pid\":" << pid << ",\"tid\":" << event.thread;
+		if (!event.detail.empty()) {
+			out << ",\"args\":{\"detail\":";
+			writeJsonString(out, event.detail);
+			out << '}';
+		}
+		out << '}';
+	}
+	out << "\n]}\n";
+	events.clear();
+}
+
+uint64_t Tracer::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void Tracer::record(const char* name, std::string detail, uint64_t start, uint64_t end) {
+	uint32_t thread = getThreadId();
+	std::lock_guard guard(eventsLock);
+	if (!isEnabled()) return;
+	events.push_back({ name, std::move(detail), thread, start, end });
+}
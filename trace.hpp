@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include "utils.hpp"
+
+// Records scoped spans and writes them as Chrome trace-event JSON, which chrome://tracing and
+// https://ui.perfetto.dev can open. While tracing is disabled a span costs a relaxed atomic load.
+class Tracer {
+	static std::atomic<bool> enabled;
+public:
+	// Starts recording, the spans are written to file by finish
+	static void start(const fs::path& file);
+	// Writes the spans recorded so far and stops recording, prints a warning if the file can't be written
+	static void finish();
+
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+	// Nanoseconds since start
+	static uint64_t now();
+	static void record(const char* name, std::string detail, uint64_t start, uint64_t end);
+};
+
+class TraceScope {
+	const char* name;
+	std::string detail;
+	uint64_t start = 0;
+public:
+	// name must be a literal, detail (like a path) is only copied while tracing
+	TraceScope(const char* name, std::string_view detail = {}) : name(Tracer::isEnabled() ? name : nullptr) {
+		if (!this->name) return;
+		this->detail = detail;
+		start = Tracer::now();
+	}
+	TraceScope(const TraceScope&) = delete;
+	~TraceScope() {
+		if (name) Tracer::record(name, std::move(detail), start, Tracer::now());
+	}
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// Records a span from here to the end of the enclosing scope
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
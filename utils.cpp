@@ -1,6 +1,24 @@
 #include "utils.hpp"
+#include <cstdio>
 
 std::string getEnviroment(std::string_view name) {
 	char* val = getenv(name.data());
 	return val ? val : ""s;
 }
+
+void appendJsonString(std::string& out, std::string_view str) {
+	out += '"';
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if ((unsigned char)c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof escaped, "\\u%04x", c);
+			out += escaped;
+		} else {
+			out += c;
+		}
+	}
+	out += '"';
+}
@@ -19,6 +19,8 @@ using std::begin;
 using std::end;
 
 std::string getEnviroment(std::string_view name);
+// Appends str as a quoted JSON string
+void appendJsonString(std::string& out, std::string_view str);
 
 template<typename T> std::vector<T> prepend(std::vector<T> vec, T val) {
 	vec.insert(std::begin(vec), val);